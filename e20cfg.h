@@ -0,0 +1,720 @@
+/*
+CS-UY 2214
+Static control-flow analysis of E20 programs
+e20cfg.h
+
+build_cfg takes a machine whose memory holds a program loaded by
+load_machine_code and, without running it, finds the basic blocks
+reachable from address 0, the edges between them (from j, jal, jeq
+and jr), the loop nests, the words of the image that can never
+execute, and the lw/sw addresses that can be worked out statically.
+
+Register values are tracked by constant propagation, starting from
+the all-zero registers of a freshly reset machine. jr through a
+known constant goes to that address; jr $7 otherwise goes to every
+return site of a jal, provided only jal writes $7; any other jr is
+marked indirect and its targets are missing from the graph, so the
+unreachable ranges are then flagged as incomplete. The
+analysis assumes the program does not overwrite its own code and
+that pc stays below the memory size. Addresses are taken modulo the
+memory size, and a j, jal or jr whose target equals pc halts, as in
+the simulators.
+*/
+
+#ifndef E20CFG_H
+#define E20CFG_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+/*
+    The fields of one E20 instruction. imm is sign extended; imm13,
+    the absolute address of j and jal, is not.
+*/
+struct E20Instr {
+    unsigned opcode;
+    unsigned regA;
+    unsigned regB;
+    unsigned regC;
+    unsigned func;
+    int64_t imm;
+    uint64_t imm13;
+};
+
+inline E20Instr decode_instr(uint64_t instr) {
+    E20Instr d;
+    d.opcode = (instr >> 13) & 7;
+    d.regA = (instr >> 10) & 7;
+    d.regB = (instr >> 7) & 7;
+    d.regC = (instr >> 4) & 7;
+    d.func = instr & 15;
+    d.imm = instr & 127;
+    d.imm = (d.imm & 64) ? d.imm - 128 : d.imm;
+    d.imm13 = instr & 8191;
+    return d;
+}
+
+/*
+    A straight-line run of instructions [start, end). Successors and
+    predecessors are block numbers.
+*/
+struct BasicBlock {
+    size_t start;
+    size_t end;
+    std::vector<size_t> succs;
+    std::vector<size_t> preds;
+    // ends in a halting j, jal or jr
+    bool halts = false;
+    // ends in a jr whose targets could not all be found
+    bool indirect = false;
+    // number of loops this block is in; 0 outside any loop
+    int loop_depth = 0;
+};
+
+/*
+    A natural loop: its header block, every block in its body
+    (header included), and the innermost enclosing loop, or -1.
+*/
+struct Loop {
+    size_t header;
+    std::vector<size_t> blocks;
+    int parent = -1;
+    int depth = 1;
+};
+
+/*
+    What is statically known about the address of one lw or sw.
+
+    ACCESS_CONSTANT: always address.
+    ACCESS_STRIDED: inside loop, whose base register is stepped by
+        one addi that runs exactly once per iteration, so the address
+        moves by stride per iteration; first is the address in the
+        first iteration if known_first.
+    ACCESS_UNKNOWN: depends on loaded data or on several paths.
+*/
+enum AccessKind { ACCESS_CONSTANT, ACCESS_STRIDED, ACCESS_UNKNOWN };
+static const char* const ACCESS_KIND_NAMES[] = {"constant", "strided", "unknown"};
+
+struct MemAccess {
+    size_t pc;
+    bool store;
+    AccessKind kind = ACCESS_UNKNOWN;
+    uint64_t address = 0;
+    int64_t stride = 0;
+    int loop = -1;
+    bool known_first = false;
+    uint64_t first = 0;
+};
+
+struct Cfg {
+    size_t image_size = 0;
+    std::vector<BasicBlock> blocks;
+    std::vector<Loop> loops;
+    // [start, end) ranges of the image that no known edge reaches
+    std::vector<std::pair<size_t, size_t>> unreachable;
+    // false if some jr is indirect: its unknown targets may lie in the
+    // unreachable ranges, so these are not known to be dead
+    bool unreachable_complete = true;
+    std::vector<MemAccess> accesses;
+};
+
+/*
+    Register contents during constant propagation. A register is
+    either a known constant or unknown.
+*/
+struct RegValues {
+    std::vector<bool> known;
+    std::vector<uint64_t> value;
+
+    bool operator==(const RegValues &other) const {
+        return known == other.known && value == other.value;
+    }
+};
+
+/*
+    The meet of two register states: a register stays known only if
+    both agree on its value.
+*/
+inline void meet_regs(RegValues &into, const RegValues &from) {
+    for (size_t reg = 0; reg < into.known.size(); reg++)
+        if (into.known[reg] && (!from.known[reg] || from.value[reg] != into.value[reg]))
+            into.known[reg] = false;
+}
+
+/*
+    Applies one instruction at addr to the register state, as the
+    simulators would.
+*/
+inline void transfer_instr(const E20Instr &d, size_t addr, RegValues &r, uint64_t word_mask) {
+    auto set = [&](unsigned reg, bool known, uint64_t value) {
+        r.known[reg] = known;
+        r.value[reg] = value & word_mask;
+    };
+    bool ab_known = r.known[d.regA] && r.known[d.regB];
+    uint64_t a = r.value[d.regA];
+    uint64_t b = r.value[d.regB];
+    switch (d.opcode) {
+    case 0:
+        if (d.func == 0)
+            set(d.regC, ab_known, a + b);
+        else if (d.func == 1)
+            set(d.regC, ab_known, a - b);
+        else if (d.func == 2)
+            set(d.regC, ab_known, a | b);
+        else if (d.func == 3)
+            set(d.regC, ab_known, a & b);
+        else if (d.func == 4)
+            set(d.regC, ab_known, a < b);
+        break;
+    case 1: // addi
+        set(d.regB, r.known[d.regA], a + d.imm);
+        break;
+    case 3: // jal
+        set(7, true, addr + 1);
+        break;
+    case 4: // lw
+        set(d.regB, false, 0);
+        break;
+    case 7: // slti
+        set(d.regB, r.known[d.regA], a < (uint64_t(d.imm) & word_mask));
+        break;
+    }
+    r.known[0] = true;
+    r.value[0] = 0;
+}
+
+/*
+    Does this instruction end a basic block?
+*/
+inline bool ends_block(const E20Instr &d) {
+    if (d.opcode == 0)
+        return d.func > 4; // jr, or an undefined function that spins in place
+    return d.opcode == 2 || d.opcode == 3 || d.opcode == 6;
+}
+
+/*
+    Does this instruction write reg?
+*/
+inline bool writes_reg(const E20Instr &d, unsigned reg) {
+    if (reg == 0)
+        return false;
+    if (d.opcode == 0)
+        return d.func <= 4 && d.regC == reg;
+    if (d.opcode == 1 || d.opcode == 4 || d.opcode == 7)
+        return d.regB == reg;
+    return d.opcode == 3 && reg == 7;
+}
+
+/*
+    Immediate dominators of every block reachable from block 0, by the
+    iterative algorithm of Cooper, Harvey and Kennedy.
+*/
+inline std::vector<size_t> find_dominators(const std::vector<BasicBlock> &blocks) {
+    size_t n = blocks.size();
+    std::vector<size_t> order;
+    std::vector<size_t> rpo_index(n, SIZE_MAX);
+    std::vector<bool> visited(n, false);
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.push_back(std::make_pair(0, 0));
+    visited[0] = true;
+    while (!stack.empty()) {
+        size_t block = stack.back().first;
+        size_t &next = stack.back().second;
+        if (next < blocks[block].succs.size()) {
+            size_t succ = blocks[block].succs[next++];
+            if (!visited[succ]) {
+                visited[succ] = true;
+                stack.push_back(std::make_pair(succ, 0));
+            }
+        } else {
+            order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++)
+        rpo_index[order[i]] = i;
+
+    std::vector<size_t> idom(n, SIZE_MAX);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            size_t block = order[i];
+            size_t new_idom = SIZE_MAX;
+            for (size_t pred : blocks[block].preds) {
+                if (idom[pred] == SIZE_MAX)
+                    continue;
+                if (new_idom == SIZE_MAX) {
+                    new_idom = pred;
+                    continue;
+                }
+                size_t x = pred, y = new_idom;
+                while (x != y) {
+                    while (rpo_index[x] > rpo_index[y])
+                        x = idom[x];
+                    while (rpo_index[y] > rpo_index[x])
+                        y = idom[y];
+                }
+                new_idom = x;
+            }
+            if (new_idom != idom[block]) {
+                idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+inline bool dominates(const std::vector<size_t> &idom, size_t a, size_t b) {
+    while (true) {
+        if (a == b)
+            return true;
+        if (b == 0 || idom[b] == SIZE_MAX)
+            return false;
+        b = idom[b];
+    }
+}
+
+/*
+    Builds the control-flow graph, loop nests and static access
+    patterns of the program in m.
+
+    @param m Machine holding the loaded program
+    @param image_size Number of words loaded, as returned by
+        load_machine_code
+    @return The analysis results
+*/
+template <typename Machine>
+Cfg build_cfg(const Machine &m, size_t image_size) {
+    typedef typename Machine::word Word;
+    const size_t mask = Machine::ADDR_MASK;
+    const uint64_t word_mask = Word(~Word(0));
+    auto instr_at = [&](size_t addr) { return decode_instr(m.memory.load(addr)); };
+
+    Cfg cfg;
+    cfg.image_size = image_size;
+    // targets found so far for each jr, as full register values (a jump
+    // halts only if the target equals pc before it is masked); these
+    // only ever grow
+    std::map<size_t, std::set<uint64_t>> jr_targets;
+    std::set<size_t> jr_indirect;
+    std::vector<RegValues> block_in;
+
+    // Alternate between building the graph and propagating constants
+    // until the jr targets stop changing.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // Reachable instructions and leaders
+        std::set<size_t> return_sites;
+        std::set<size_t> reached;
+        std::set<size_t> leaders;
+        std::vector<size_t> worklist;
+        leaders.insert(0);
+        worklist.push_back(0);
+        reached.insert(0);
+        auto reach = [&](size_t addr, bool leader) {
+            if (leader)
+                leaders.insert(addr);
+            if (reached.insert(addr).second)
+                worklist.push_back(addr);
+        };
+        while (!worklist.empty()) {
+            size_t addr = worklist.back();
+            worklist.pop_back();
+            E20Instr d = instr_at(addr);
+            size_t next = (addr + 1) & mask;
+            if (d.opcode == 2 || d.opcode == 3) {
+                uint64_t target = d.imm13;
+                if (d.opcode == 3)
+                    return_sites.insert(next);
+                if (target != addr)
+                    reach(target & mask, true);
+            } else if (d.opcode == 6) {
+                reach(next, true);
+                reach((addr + 1 + d.imm) & mask, true);
+            } else if (d.opcode == 0 && d.func == 8) {
+                for (uint64_t target : jr_targets[addr])
+                    if (target != addr)
+                        reach(target & mask, true);
+            } else if (d.opcode == 0 && d.func > 4) {
+                reach(addr, true);
+            } else {
+                reach(next, false);
+            }
+        }
+        // a jal's return site starts a block even before any jr reaches it
+        for (size_t site : return_sites)
+            if (reached.count(site))
+                leaders.insert(site);
+
+        // Basic blocks
+        cfg.blocks.clear();
+        std::map<size_t, size_t> block_at;
+        for (size_t leader : leaders) {
+            if (!reached.count(leader))
+                continue;
+            BasicBlock block;
+            block.start = leader;
+            size_t addr = leader;
+            while (true) {
+                E20Instr d = instr_at(addr);
+                size_t next = (addr + 1) & mask;
+                if (ends_block(d) || next == 0 || leaders.count(next) || !reached.count(next)) {
+                    block.end = addr + 1;
+                    break;
+                }
+                addr = next;
+            }
+            block_at[leader] = cfg.blocks.size();
+            cfg.blocks.push_back(block);
+        }
+        for (size_t b = 0; b < cfg.blocks.size(); b++) {
+            BasicBlock &block = cfg.blocks[b];
+            size_t last = block.end - 1;
+            E20Instr d = instr_at(last);
+            size_t next = block.end & mask;
+            std::vector<size_t> targets;
+            if (d.opcode == 2 || d.opcode == 3) {
+                uint64_t target = d.imm13;
+                if (target == last)
+                    block.halts = true;
+                else
+                    targets.push_back(target & mask);
+            } else if (d.opcode == 6) {
+                targets.push_back(next);
+                targets.push_back((last + 1 + d.imm) & mask);
+            } else if (d.opcode == 0 && d.func == 8) {
+                block.indirect = jr_indirect.count(last) > 0;
+                for (uint64_t target : jr_targets[last]) {
+                    if (target == last)
+                        block.halts = true;
+                    else
+                        targets.push_back(target & mask);
+                }
+            } else if (d.opcode == 0 && d.func > 4) {
+                targets.push_back(last);
+            } else {
+                targets.push_back(next);
+            }
+            for (size_t target : targets) {
+                size_t succ = block_at[target];
+                if (std::find(block.succs.begin(), block.succs.end(), succ) == block.succs.end())
+                    block.succs.push_back(succ);
+            }
+        }
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+            for (size_t succ : cfg.blocks[b].succs)
+                cfg.blocks[succ].preds.push_back(b);
+
+        // Constant propagation over the blocks
+        RegValues unset;
+        unset.known.assign(Machine::NUM_REGS, false);
+        unset.value.assign(Machine::NUM_REGS, 0);
+        RegValues reset;
+        reset.known.assign(Machine::NUM_REGS, true);
+        reset.value.assign(Machine::NUM_REGS, 0);
+        block_in.assign(cfg.blocks.size(), unset);
+        std::vector<bool> visited(cfg.blocks.size(), false);
+        block_in[0] = reset;
+        visited[0] = true;
+        std::vector<size_t> pending(1, 0);
+        while (!pending.empty()) {
+            size_t b = pending.back();
+            pending.pop_back();
+            RegValues r = block_in[b];
+            for (size_t addr = cfg.blocks[b].start; addr < cfg.blocks[b].end; addr++)
+                transfer_instr(instr_at(addr), addr, r, word_mask);
+            for (size_t succ : cfg.blocks[b].succs) {
+                RegValues in = block_in[succ];
+                if (!visited[succ])
+                    in = r;
+                else
+                    meet_regs(in, r);
+                if (!visited[succ] || !(in == block_in[succ])) {
+                    visited[succ] = true;
+                    block_in[succ] = in;
+                    pending.push_back(succ);
+                }
+            }
+        }
+
+        // Resolve jr targets from the propagated constants. An unknown
+        // $7 can only hold a return address if nothing but jal writes it.
+        bool ra_from_jal = true;
+        for (size_t addr : reached) {
+            E20Instr d = instr_at(addr);
+            if (d.opcode != 3 && writes_reg(d, 7))
+                ra_from_jal = false;
+        }
+        // Blocks reachable from the entry without passing a jal, where
+        // $7 may still hold its reset value
+        std::vector<bool> before_jal(cfg.blocks.size(), false);
+        std::vector<size_t> stack(1, 0);
+        before_jal[0] = true;
+        while (!stack.empty()) {
+            size_t b = stack.back();
+            stack.pop_back();
+            if (instr_at(cfg.blocks[b].end - 1).opcode == 3)
+                continue;
+            for (size_t succ : cfg.blocks[b].succs)
+                if (!before_jal[succ]) {
+                    before_jal[succ] = true;
+                    stack.push_back(succ);
+                }
+        }
+        for (size_t b = 0; b < cfg.blocks.size(); b++) {
+            size_t last = cfg.blocks[b].end - 1;
+            E20Instr d = instr_at(last);
+            if (d.opcode != 0 || d.func != 8)
+                continue;
+            RegValues r = block_in[b];
+            for (size_t addr = cfg.blocks[b].start; addr < last; addr++)
+                transfer_instr(instr_at(addr), addr, r, word_mask);
+            std::set<uint64_t> &targets = jr_targets[last];
+            size_t before = targets.size();
+            if (r.known[d.regA])
+                targets.insert(r.value[d.regA]);
+            else if (d.regA == 7 && ra_from_jal) {
+                targets.insert(return_sites.begin(), return_sites.end());
+                if (before_jal[b])
+                    targets.insert(0);
+            }
+            else if (jr_indirect.insert(last).second)
+                changed = true;
+            if (targets.size() != before)
+                changed = true;
+        }
+    }
+
+    // Unreachable words of the image
+    cfg.unreachable_complete = jr_indirect.empty();
+    std::vector<bool> covered(cfg.image_size, false);
+    for (const BasicBlock &block : cfg.blocks)
+        for (size_t addr = block.start; addr < block.end && addr < cfg.image_size; addr++)
+            covered[addr] = true;
+    for (size_t addr = 0; addr < cfg.image_size; addr++) {
+        if (covered[addr])
+            continue;
+        size_t start = addr;
+        while (addr < cfg.image_size && !covered[addr])
+            addr++;
+        cfg.unreachable.push_back(std::make_pair(start, addr));
+    }
+
+    // Natural loops, one per header, then their nesting
+    std::vector<size_t> idom = find_dominators(cfg.blocks);
+    std::map<size_t, std::set<size_t>> bodies;
+    for (size_t b = 0; b < cfg.blocks.size(); b++) {
+        for (size_t header : cfg.blocks[b].succs) {
+            if (!dominates(idom, header, b))
+                continue;
+            std::set<size_t> &body = bodies[header];
+            body.insert(header);
+            std::vector<size_t> stack;
+            if (body.insert(b).second)
+                stack.push_back(b);
+            while (!stack.empty()) {
+                size_t x = stack.back();
+                stack.pop_back();
+                for (size_t pred : cfg.blocks[x].preds)
+                    if (body.insert(pred).second)
+                        stack.push_back(pred);
+            }
+        }
+    }
+    for (auto &entry : bodies) {
+        Loop loop;
+        loop.header = entry.first;
+        loop.blocks.assign(entry.second.begin(), entry.second.end());
+        cfg.loops.push_back(loop);
+    }
+    // outer loops first, so that parents are numbered before children
+    std::stable_sort(cfg.loops.begin(), cfg.loops.end(), [](const Loop &a, const Loop &b) {
+        return a.blocks.size() > b.blocks.size();
+    });
+    auto contains = [](const Loop &loop, size_t block) {
+        return std::binary_search(loop.blocks.begin(), loop.blocks.end(), block);
+    };
+    // innermost loop containing each block
+    std::vector<int> innermost(cfg.blocks.size(), -1);
+    for (size_t l = 0; l < cfg.loops.size(); l++) {
+        Loop &loop = cfg.loops[l];
+        for (size_t outer = l; outer-- > 0;) {
+            if (contains(cfg.loops[outer], loop.header)) {
+                loop.parent = outer;
+                loop.depth = cfg.loops[outer].depth + 1;
+                break;
+            }
+        }
+        for (size_t b : loop.blocks) {
+            innermost[b] = l;
+            cfg.blocks[b].loop_depth = loop.depth;
+        }
+    }
+
+    // Static lw/sw address patterns
+    for (size_t b = 0; b < cfg.blocks.size(); b++) {
+        RegValues r = block_in[b];
+        for (size_t addr = cfg.blocks[b].start; addr < cfg.blocks[b].end; addr++) {
+            E20Instr d = instr_at(addr);
+            if (d.opcode == 4 || d.opcode == 5) {
+                MemAccess access;
+                access.pc = addr;
+                access.store = d.opcode == 5;
+                unsigned base = d.regA;
+                if (r.known[base]) {
+                    access.kind = ACCESS_CONSTANT;
+                    access.address = (r.value[base] + d.imm) & word_mask & mask;
+                } else if (innermost[b] >= 0) {
+                    // an induction variable: one addi base,base,k in the loop
+                    const Loop &loop = cfg.loops[innermost[b]];
+                    int writes = 0;
+                    size_t step_block = 0, step_addr = 0;
+                    int64_t step = 0;
+                    for (size_t lb : loop.blocks) {
+                        for (size_t a = cfg.blocks[lb].start; a < cfg.blocks[lb].end; a++) {
+                            E20Instr w = instr_at(a);
+                            if (!writes_reg(w, base))
+                                continue;
+                            writes++;
+                            if (w.opcode == 1 && w.regA == base) {
+                                step = w.imm;
+                                step_block = lb;
+                                step_addr = a;
+                            } else
+                                writes++;
+                        }
+                    }
+                    // the addi must run exactly once per iteration: not in
+                    // an inner loop, and on the way to every back edge
+                    bool every_iteration = writes == 1 && innermost[step_block] == innermost[b];
+                    for (size_t latch : cfg.blocks[loop.header].preds)
+                        if (every_iteration && contains(loop, latch) && !dominates(idom, step_block, latch))
+                            every_iteration = false;
+                    if (every_iteration) {
+                        access.kind = ACCESS_STRIDED;
+                        access.stride = step;
+                        access.loop = innermost[b];
+                        // the base on entry to the loop, if all entries agree
+                        RegValues entry;
+                        bool have_entry = false;
+                        for (size_t pred : cfg.blocks[loop.header].preds) {
+                            if (contains(loop, pred))
+                                continue;
+                            RegValues out = block_in[pred];
+                            for (size_t a = cfg.blocks[pred].start; a < cfg.blocks[pred].end; a++)
+                                transfer_instr(instr_at(a), a, out, word_mask);
+                            if (!have_entry)
+                                entry = out;
+                            else
+                                meet_regs(entry, out);
+                            have_entry = true;
+                        }
+                        bool step_first = step_block == b ? step_addr < addr : dominates(idom, step_block, b);
+                        bool access_first = step_block == b ? addr < step_addr : dominates(idom, b, step_block);
+                        if (have_entry && entry.known[base] && (step_first || access_first)) {
+                            access.known_first = true;
+                            access.first = (entry.value[base] + (step_first ? step : 0) + d.imm) & word_mask & mask;
+                        }
+                    }
+                }
+                cfg.accesses.push_back(access);
+            }
+            transfer_instr(d, addr, r, word_mask);
+        }
+    }
+    return cfg;
+}
+
+/*
+    Writes the analysis as one JSON object.
+*/
+inline void write_cfg_json(const Cfg &cfg, std::ostream &out) {
+    out << "{\"image_size\":" << cfg.image_size << ",\"entry\":0,\"blocks\":[";
+    for (size_t b = 0; b < cfg.blocks.size(); b++) {
+        const BasicBlock &block = cfg.blocks[b];
+        out << (b ? "," : "") << "{\"id\":" << b << ",\"start\":" << block.start << ",\"end\":" << block.end <<
+            ",\"succs\":[";
+        for (size_t i = 0; i < block.succs.size(); i++)
+            out << (i ? "," : "") << block.succs[i];
+        out << "],\"loop_depth\":" << block.loop_depth << ",\"halts\":" << (block.halts ? "true" : "false") <<
+            ",\"indirect\":" << (block.indirect ? "true" : "false") << "}";
+    }
+    out << "],\"loops\":[";
+    for (size_t l = 0; l < cfg.loops.size(); l++) {
+        const Loop &loop = cfg.loops[l];
+        out << (l ? "," : "") << "{\"id\":" << l << ",\"header\":" << loop.header << ",\"parent\":" << loop.parent <<
+            ",\"depth\":" << loop.depth << ",\"blocks\":[";
+        for (size_t i = 0; i < loop.blocks.size(); i++)
+            out << (i ? "," : "") << loop.blocks[i];
+        out << "]}";
+    }
+    out << "],\"unreachable_complete\":" << (cfg.unreachable_complete ? "true" : "false") << ",\"unreachable\":[";
+    for (size_t i = 0; i < cfg.unreachable.size(); i++)
+        out << (i ? "," : "") << "{\"start\":" << cfg.unreachable[i].first << ",\"end\":" << cfg.unreachable[i].second << "}";
+    out << "],\"memory_accesses\":[";
+    for (size_t i = 0; i < cfg.accesses.size(); i++) {
+        const MemAccess &access = cfg.accesses[i];
+        out << (i ? "," : "") << "{\"pc\":" << access.pc << ",\"op\":\"" << (access.store ? "sw" : "lw") <<
+            "\",\"kind\":\"" << ACCESS_KIND_NAMES[access.kind] << "\"";
+        if (access.kind == ACCESS_CONSTANT)
+            out << ",\"address\":" << access.address;
+        if (access.kind == ACCESS_STRIDED) {
+            out << ",\"loop\":" << access.loop << ",\"stride\":" << access.stride;
+            if (access.known_first)
+                out << ",\"first\":" << access.first;
+        }
+        out << "}";
+    }
+    out << "]}" << std::endl;
+}
+
+/*
+    Writes the graph in Graphviz DOT format. Each block is labelled
+    with its address range and loop depth; loop headers are drawn
+    bold, halting blocks with a double border, indirect jumps in red
+    and back edges dashed. If the graph is incomplete because of an
+    indirect jump, the graph label says so.
+*/
+inline void write_cfg_dot(const Cfg &cfg, std::ostream &out) {
+    std::set<size_t> headers;
+    for (const Loop &loop : cfg.loops)
+        headers.insert(loop.header);
+    out << "digraph cfg {" << std::endl;
+    out << "    node [shape=box, fontname=monospace];" << std::endl;
+    if (!cfg.unreachable_complete)
+        out << "    label=\"indirect jr: targets missing, unreached code may be live\";" << std::endl;
+    for (size_t b = 0; b < cfg.blocks.size(); b++) {
+        const BasicBlock &block = cfg.blocks[b];
+        out << "    b" << b << " [label=\"" << block.start << ".." << block.end - 1 << "\\ndepth " <<
+            block.loop_depth << "\"";
+        if (headers.count(b))
+            out << ", style=bold";
+        if (block.halts)
+            out << ", peripheries=2";
+        if (block.indirect)
+            out << ", color=red";
+        out << "];" << std::endl;
+    }
+    for (size_t b = 0; b < cfg.blocks.size(); b++) {
+        for (size_t succ : cfg.blocks[b].succs) {
+            out << "    b" << b << " -> b" << succ;
+            if (headers.count(succ) && cfg.blocks[succ].start <= cfg.blocks[b].start)
+                out << " [style=dashed]";
+            out << ";" << std::endl;
+        }
+    }
+    out << "}" << std::endl;
+}
+
+#endif
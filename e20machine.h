@@ -0,0 +1,145 @@
+/*
+CS-UY 2214
+Machine configurations for the E20 simulators
+e20machine.h
+
+The standard E20 has 8 registers, 16-bit words and 8192 words of
+memory. E20Machine describes the state of a machine with a different
+word type, memory size or register count, and the simulators are
+templates over it. The configurations at the bottom of this file are
+the ones the simulators instantiate and offer through --mem-bits.
+*/
+
+#ifndef E20MACHINE_H
+#define E20MACHINE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/*
+    Memory as one contiguous, zero-filled array of MemSize words.
+*/
+template <typename Word, size_t MemSize>
+class FlatMemory {
+public:
+    FlatMemory() : words(MemSize) {}
+
+    Word load(size_t addr) const {
+        return words[addr];
+    }
+
+    void store(size_t addr, Word value) {
+        words[addr] = value;
+    }
+
+    bool operator==(const FlatMemory &other) const {
+        return words == other.words;
+    }
+
+private:
+    std::vector<Word> words;
+};
+
+/*
+    Memory as a table of pages that are only allocated when a nonzero
+    word is first stored to them. Loads from an unallocated page read
+    zero. Startup time and footprint depend on how much memory the
+    program touches, not on MemSize.
+*/
+template <typename Word, size_t MemSize, size_t PageBits = 12>
+class PagedMemory {
+public:
+    PagedMemory() : pages((MemSize + PAGE_SIZE - 1) / PAGE_SIZE) {}
+
+    PagedMemory(const PagedMemory &other) : pages(other.pages.size()) {
+        *this = other;
+    }
+
+    PagedMemory &operator=(const PagedMemory &other) {
+        for (size_t page = 0; page < pages.size(); page++) {
+            if (!other.pages[page])
+                pages[page].reset();
+            else {
+                if (!pages[page])
+                    pages[page].reset(new Word[PAGE_SIZE]);
+                std::copy(other.pages[page].get(), other.pages[page].get() + PAGE_SIZE, pages[page].get());
+            }
+        }
+        return *this;
+    }
+
+    Word load(size_t addr) const {
+        const std::unique_ptr<Word[]> &page = pages[addr >> PageBits];
+        return page ? page[addr & (PAGE_SIZE - 1)] : 0;
+    }
+
+    void store(size_t addr, Word value) {
+        std::unique_ptr<Word[]> &page = pages[addr >> PageBits];
+        if (!page) {
+            if (value == 0)
+                return;
+            page.reset(new Word[PAGE_SIZE]());
+        }
+        page[addr & (PAGE_SIZE - 1)] = value;
+    }
+
+    /*
+        Compares contents, not allocation: an unallocated page equals
+        an allocated one that holds only zeros.
+    */
+    bool operator==(const PagedMemory &other) const {
+        for (size_t page = 0; page < pages.size(); page++) {
+            const Word* a = pages[page].get();
+            const Word* b = other.pages[page].get();
+            if (a == b)
+                continue;
+            for (size_t i = 0; i < PAGE_SIZE; i++)
+                if ((a ? a[i] : 0) != (b ? b[i] : 0))
+                    return false;
+        }
+        return true;
+    }
+
+private:
+    static const size_t PAGE_SIZE = size_t(1) << PageBits;
+    std::vector<std::unique_ptr<Word[]>> pages;
+};
+
+/*
+    The architectural state of an E20 machine: pc, registers and
+    memory. Instructions keep their 16-bit encoding whatever the word
+    type, so register fields are three bits wide and NumRegs must be at
+    least 8. j and jal hold a 13-bit address, so they can only reach
+    the first 8K words; code above that is reached with jr. Memories
+    up to 64K words are flat arrays; larger ones are paged.
+*/
+template <typename Word, size_t MemSize, size_t NumRegs = 8>
+struct E20Machine {
+    static_assert((MemSize & (MemSize - 1)) == 0, "memory size must be a power of two");
+    static_assert(MemSize - 1 <= Word(~Word(0)), "every address must fit in a word");
+    static_assert(NumRegs >= 8, "instructions name registers with three bits");
+
+    typedef Word word;
+    static const size_t MEM_SIZE = MemSize;
+    static const size_t ADDR_MASK = MemSize - 1;
+    static const size_t NUM_REGS = NumRegs;
+    typedef typename std::conditional<(MemSize <= (size_t(1) << 16)),
+        FlatMemory<Word, MemSize>, PagedMemory<Word, MemSize>>::type memory_type;
+
+    Word pc = 0;
+    Word regs[NumRegs] = {};
+    memory_type memory;
+};
+
+// The standard E20
+typedef E20Machine<uint16_t, 1<<13> E20;
+// Extended variants for larger workloads
+typedef E20Machine<uint16_t, 1<<16> E20_64K;
+typedef E20Machine<uint32_t, 1<<20> E20_1M;
+typedef E20Machine<uint32_t, 1<<24> E20_16M;
+
+#endif
@@ -0,0 +1,212 @@
+/*
+CS-UY 2214
+Host performance counters for the E20 simulators
+perfcount.h
+
+Measures how the host CPU behaves while it runs the simulator:
+cycles, instructions, branch misses and L1D/LLC misses, split by
+phase (loading the program, executing it, and the cache model).
+Counters come from perf_event_open on Linux. Where they cannot be
+opened (other systems, containers, perf_event_paranoid) each one is
+reported as null and only wall-clock time is measured.
+*/
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum PerfPhase { PERF_LOAD, PERF_EXECUTE, PERF_CACHE, NUM_PERF_PHASES };
+enum PerfEvent { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES,
+    PERF_LLC_MISSES, NUM_PERF_EVENTS };
+
+static const char* const PERF_PHASE_NAMES[] = {"load", "execute", "cache"};
+static const char* const PERF_EVENT_NAMES[] = {"cycles", "instructions", "branch_misses",
+    "l1d_misses", "llc_misses"};
+
+/*
+    Counter state for one run of a simulator. Phases may nest (the
+    cache phase runs inside the execute phase); each keeps its own
+    start snapshot and running totals.
+*/
+struct PerfCounters {
+    bool enabled = false;
+    // measure the cache phase; off by default because it costs two
+    // counter reads per lw/sw, which would then dominate execute
+    bool cache_phase = false;
+    int group_fd = -1;
+    // position of each event in a group read, or -1 if unavailable
+    int slot[NUM_PERF_EVENTS] = {-1, -1, -1, -1, -1};
+    int num_open = 0;
+    uint64_t start[NUM_PERF_PHASES][NUM_PERF_EVENTS] = {};
+    uint64_t totals[NUM_PERF_PHASES][NUM_PERF_EVENTS] = {};
+    // how long the group was actually on the PMU, per phase; 0 means
+    // it was never scheduled and the totals mean nothing
+    uint64_t start_running[NUM_PERF_PHASES] = {};
+    uint64_t running[NUM_PERF_PHASES] = {};
+    uint64_t calls[NUM_PERF_PHASES] = {};
+    std::chrono::steady_clock::time_point start_time[NUM_PERF_PHASES];
+    std::chrono::nanoseconds time[NUM_PERF_PHASES] = {};
+};
+
+/*
+    Opens the hardware counters as a single group, so that one read
+    returns all of them. Events the host does not support are skipped.
+    Wall-clock timing works even if no counter could be opened.
+
+    @param perf The counters to open
+*/
+inline void perf_open(PerfCounters &perf) {
+    perf.enabled = true;
+#ifdef __linux__
+    static const uint32_t TYPES[NUM_PERF_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+    static const uint64_t CONFIGS[NUM_PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    };
+    for (int event = 0; event < NUM_PERF_EVENTS; event++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = TYPES[event];
+        attr.config = CONFIGS[event];
+        attr.disabled = perf.group_fd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf.group_fd, 0);
+        if (fd == -1)
+            continue;
+        if (perf.group_fd == -1)
+            perf.group_fd = fd;
+        perf.slot[event] = perf.num_open++;
+    }
+    if (perf.group_fd != -1)
+        ioctl(perf.group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+/*
+    Reads the current value of every open counter into values, and
+    the time the group has spent on the PMU into running. If the host
+    had to multiplex the group with other events, each value is scaled
+    up by the time the group was enabled over the time it ran.
+*/
+inline void perf_read(PerfCounters &perf, uint64_t values[NUM_PERF_EVENTS], uint64_t &running) {
+#ifdef __linux__
+    if (perf.group_fd != -1) {
+        // nr, time_enabled, time_running, then one value per event
+        uint64_t buf[3 + NUM_PERF_EVENTS];
+        if (read(perf.group_fd, buf, sizeof(buf)) > 0) {
+            uint64_t enabled = buf[1];
+            running = buf[2];
+            for (int event = 0; event < NUM_PERF_EVENTS; event++) {
+                uint64_t value = perf.slot[event] >= 0 ? buf[3 + perf.slot[event]] : 0;
+                if (running > 0 && running < enabled)
+                    value = uint64_t(double(value) * enabled / running);
+                values[event] = value;
+            }
+            return;
+        }
+    }
+#endif
+    running = 0;
+    memset(values, 0, NUM_PERF_EVENTS * sizeof(uint64_t));
+}
+
+inline void perf_begin(PerfCounters &perf, PerfPhase phase) {
+    if (!perf.enabled || (phase == PERF_CACHE && !perf.cache_phase))
+        return;
+    perf.calls[phase]++;
+    perf.start_time[phase] = std::chrono::steady_clock::now();
+    perf_read(perf, perf.start[phase], perf.start_running[phase]);
+}
+
+inline void perf_end(PerfCounters &perf, PerfPhase phase) {
+    if (!perf.enabled || (phase == PERF_CACHE && !perf.cache_phase))
+        return;
+    uint64_t now[NUM_PERF_EVENTS];
+    uint64_t now_running;
+    perf_read(perf, now, now_running);
+    perf.time[phase] += std::chrono::steady_clock::now() - perf.start_time[phase];
+    perf.running[phase] += now_running - perf.start_running[phase];
+    // scaled estimates can step backwards when the multiplexing ratio changes
+    for (int event = 0; event < NUM_PERF_EVENTS; event++)
+        if (now[event] > perf.start[phase][event])
+            perf.totals[phase][event] += now[event] - perf.start[phase][event];
+}
+
+/*
+    Writes the measurements as a single JSON object. Totals are given
+    per phase, together with the same totals divided by the number of
+    simulated E20 instructions. Counters that could not be opened are
+    null, and so are all counters of a phase during which the host
+    never scheduled the group (counters_available is then false if
+    that happened in every phase). Counts from a multiplexed group are
+    scaled estimates. The cache phase is only measured if cache_phase is set
+    (calls is 0 otherwise). It brackets every lw/sw with two counter
+    reads, and those reads run inside the execute phase, so with it
+    set the execute totals and the cache totals both include that
+    overhead, and execute is no longer a measure of the simulator
+    itself. Use it to compare runs that all have it set.
+
+    @param perf The counters to report
+    @param out Stream to write to
+    @param tool Name of the simulator, e.g. "sim"
+    @param sim_instructions Number of E20 instructions simulated
+*/
+inline void perf_report(PerfCounters &perf, std::ostream &out, const char* tool, uint64_t sim_instructions) {
+    bool available = false;
+    for (int phase = 0; phase < NUM_PERF_PHASES; phase++)
+        if (perf.num_open > 0 && perf.running[phase] > 0)
+            available = true;
+    out << "{\"tool\":\"" << tool << "\",\"sim_instructions\":" << sim_instructions <<
+        ",\"counters_available\":" << (available ? "true" : "false") << ",\"phases\":{";
+    for (int phase = 0; phase < NUM_PERF_PHASES; phase++) {
+        if (phase > 0)
+            out << ",";
+        out << "\"" << PERF_PHASE_NAMES[phase] << "\":{\"calls\":" << perf.calls[phase] <<
+            ",\"time_ns\":" << perf.time[phase].count();
+        for (int event = 0; event < NUM_PERF_EVENTS; event++) {
+            out << ",\"" << PERF_EVENT_NAMES[event] << "\":";
+            if (perf.slot[event] >= 0 && perf.running[phase] > 0)
+                out << perf.totals[phase][event];
+            else
+                out << "null";
+        }
+        out << ",\"per_sim_instruction\":{\"time_ns\":";
+        if (sim_instructions > 0)
+            out << double(perf.time[phase].count()) / sim_instructions;
+        else
+            out << "null";
+        for (int event = 0; event < NUM_PERF_EVENTS; event++) {
+            out << ",\"" << PERF_EVENT_NAMES[event] << "\":";
+            if (perf.slot[event] >= 0 && perf.running[phase] > 0 && sim_instructions > 0)
+                out << double(perf.totals[phase][event]) / sim_instructions;
+            else
+                out << "null";
+        }
+        out << "}}";
+    }
+    out << "}}" << std::endl;
+}
+
+#endif
@@ -14,24 +14,32 @@ sim.cpp
 #include <regex>
 #include <cstdlib>
 #include <cstdint>
+#include <memory>
+#include "e20machine.h"
+#include "perfcount.h"
 
 using namespace std;
 
 // Some helpful constant values that we'll be using.
-size_t const static NUM_REGS = 8;
-size_t const static MEM_SIZE = 1<<13;
+// Memory size and register count come from the E20Machine configuration.
 size_t const static REG_SIZE = 1<<16;
 
+// Host performance counters, enabled with --perf
+PerfCounters perf;
+// Total number of E20 instructions executed by simulate
+uint64_t instructions_executed = 0;
+
 /*
-    Loads an E20 machine code file into the list
-    provided by mem. We assume that mem is
-    large enough to hold the values in the machine
-    code file.
+    Loads an E20 machine code file into the memory
+    of the given machine. The program must fit in
+    the machine's memory.
 
     @param f Open file to read from
-    @param mem Array represetnting memory into which to read program
+    @param m Machine into whose memory to read program
+    @return The number of words loaded
 */
-void load_machine_code(ifstream &f, uint16_t mem[]) {
+template <typename Machine>
+size_t load_machine_code(ifstream &f, Machine &m) {
     regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
     size_t expectedaddr = 0;
     string line;
@@ -47,13 +55,14 @@ void load_machine_code(ifstream &f, uint16_t mem[]) {
             cerr << "Memory addresses encountered out of sequence: " << addr << endl;
             exit(1);
         }
-        if (addr >= MEM_SIZE) {
+        if (addr >= Machine::MEM_SIZE) {
             cerr << "Program too big for memory" << endl;
             exit(1);
         }
         expectedaddr ++;
-        mem[addr] = instr;
+        m.memory.store(addr, instr);
     }
+    return expectedaddr;
 }
 
 /*
@@ -61,23 +70,22 @@ void load_machine_code(ifstream &f, uint16_t mem[]) {
     the current program counter, the current register values,
     and the first memquantity elements of memory.
 
-    @param pc The final value of the program counter
-    @param regs Final value of all registers
-    @param memory Final value of memory
+    @param m Final state of the machine
     @param memquantity How many words of memory to dump
 */
-void print_state(uint16_t pc, uint16_t regs[], uint16_t memory[], size_t memquantity) {
+template <typename Machine>
+void print_state(const Machine &m, size_t memquantity) {
     cout << setfill(' ');
     cout << "Final state:" << endl;
-    cout << "\tpc=" <<setw(5)<< pc << endl;
+    cout << "\tpc=" <<setw(5)<< m.pc << endl;
 
-    for (size_t reg=0; reg<NUM_REGS; reg++)
-        cout << "\t$" << reg << "="<<setw(5)<<regs[reg]<<endl;
+    for (size_t reg=0; reg<Machine::NUM_REGS; reg++)
+        cout << "\t$" << reg << "="<<setw(5)<<m.regs[reg]<<endl;
 
     cout << setfill('0');
     bool cr = false;
     for (size_t count=0; count<memquantity; count++) {
-        cout << hex << setw(4) << memory[count] << " ";
+        cout << hex << setw(4) << m.memory.load(count) << " ";
         cr = true;
         if (count % 8 == 7) {
             cout << endl;
@@ -88,73 +96,43 @@ void print_state(uint16_t pc, uint16_t regs[], uint16_t memory[], size_t memquan
         cout << endl;
 }
 
-/**
-    Main function
-    Takes command-line args as documented below
-*/
-int main(int argc, char *argv[]) {
-    /*
-        Parse the command-line arguments
-    */
-    char *filename = nullptr;
-    bool do_help = false;
-    bool arg_error = false;
-    for (int i=1; i<argc; i++) {
-        string arg(argv[i]);
-        if (arg.rfind("-",0)==0) {
-            if (arg== "-h" || arg == "--help")
-                do_help = true;
-            else
-                arg_error = true;
-        } else {
-            if (filename == nullptr)
-                filename = argv[i];
-            else
-                arg_error = true;
-        }
-    }
-    /* Display error message if appropriate */
-    if (arg_error || do_help || filename == nullptr) {
-        cerr << "usage " << argv[0] << " [-h] filename" << endl << endl;
-        cerr << "Simulate E20 machine" << endl << endl;
-        cerr << "positional arguments:" << endl;
-        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
-        cerr << "optional arguments:"<<endl;
-        cerr << "  -h, --help  show this help message and exit"<<endl;
-        return 1;
-    }
-
-    ifstream f(filename);
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
-        return 1;
-    }
-    // TODO: your code here. Load f and parse using load_machine_code
-    uint16_t memory[MEM_SIZE] = {0};
-    uint16_t regs[NUM_REGS] = {0};
-    uint16_t pc = 0;
-    // Load the machine code into memory
-    load_machine_code(f, memory);
-
-    // TODO: your code here. Do simulation.
+/*
+    Runs the E20 program in memory until it halts or until
+    max_steps instructions have been executed, whichever comes
+    first. The machine state is updated in place, so a run cut
+    short by the step budget can be resumed by calling again.
 
+    @param m The machine to run, updated in place
+    @param max_steps The most instructions to execute
+    @return true if the program halted
+*/
+template <typename Machine>
+bool simulate(Machine &m, size_t max_steps = SIZE_MAX) {
+    typedef typename Machine::word Word;
+    // pc is kept in a local so that stores to memory cannot alias it
+    Word pc = m.pc;
+    Word *regs = m.regs;
+    typename Machine::memory_type &memory = m.memory;
     bool running = true;
 
-    while (running) {
+    size_t steps = 0;
+    while (running && steps < max_steps) {
+        steps++;
         //cout << "running" << endl;
-        uint16_t instr = memory[pc & 8191];
+        Word instr = memory.load(pc & Machine::ADDR_MASK);
         uint16_t opcode = (instr >> 13) & 7;
         uint16_t regA = (instr >> 10) & 7;
         uint16_t regB = (instr >> 7) & 7;
         uint16_t regC = (instr >> 4) & 7;
 
-        uint16_t imm = instr & 127;
-        uint16_t imm13 = instr & 8191;
+        Word imm = instr & 127;
+        Word imm13 = instr & 8191;
         uint16_t final_four = instr & 15;  
 
         // sign extend imm 
-        imm = (imm & 64) ? (imm | 65408) : imm; 
-        imm13 = (imm13 & 4096) ? (imm13 | 57344) : imm13;
+        imm = (imm & 64) ? (imm | Word(~127)) : imm; 
+        // imm13 is an absolute address for j and jal, so it is not sign
+        // extended; this matters once memory is larger than 8K words
         //remove pc here
         //pc++;
 
@@ -167,7 +145,7 @@ int main(int argc, char *argv[]) {
 
         // Handle each opcode with if-else conditions.
         if (opcode == 2) {  // j (jump)
-            if (pc%8192 == imm13)
+            if (pc % Machine::MEM_SIZE == imm13)
                 running = false;
             pc = imm13;
         } 
@@ -236,17 +214,17 @@ int main(int argc, char *argv[]) {
         }
         
         if (opcode == 4){ // (load word)
-            uint16_t memory_address = (regs[regA] + imm) % 8192;
+            Word memory_address = Word(regs[regA] + imm) & Machine::ADDR_MASK;
             //edited above to be %8192
-            regs[regB] = memory[memory_address];
+            regs[regB] = memory.load(memory_address);
             //added pc++
             pc++;
             //cout << memory_address << " " << regs[regB] << " " << endl;
         }
         if (opcode == 5){ // (store word)
-            uint16_t memory_address = regs[regA] + imm;
+            Word memory_address = regs[regA] + imm;
             //added %8192
-            memory[memory_address % 8192] = regs[regB];
+            memory.store(memory_address & Machine::ADDR_MASK, regs[regB]);
             //uncommented pc++
             pc++;
         }
@@ -271,7 +249,117 @@ int main(int argc, char *argv[]) {
     //added code to set reg[0] to 0, to make it immutable
     regs[0] = 0;
     }
+    m.pc = pc;
+    instructions_executed += steps;
+    return !running;
+}
+
+/*
+    Loads, runs and prints the final state of a program
+    on a machine of the given configuration.
+
+    @param f Open file containing the machine code
+    @param perf_file Where to write performance counters, if not empty
+    @return The exit status for main
+*/
+template <typename Machine>
+int run_machine(ifstream &f, const string &perf_file) {
+    // Heap-allocated, since the flat memory of the larger
+    // configurations does not belong on the stack
+    unique_ptr<Machine> m(new Machine());
+    if (!perf_file.empty())
+        perf_open(perf);
+    // Load the machine code into memory
+    perf_begin(perf, PERF_LOAD);
+    load_machine_code(f, *m);
+    perf_end(perf, PERF_LOAD);
 
-    print_state(pc, regs, memory, 128);
+    perf_begin(perf, PERF_EXECUTE);
+    simulate(*m);
+    perf_end(perf, PERF_EXECUTE);
+
+    print_state(*m, 128);
+    if (perf_file == "-")
+        perf_report(perf, cerr, "sim", instructions_executed);
+    else if (!perf_file.empty()) {
+        ofstream perf_out(perf_file);
+        perf_report(perf, perf_out, "sim", instructions_executed);
+    }
     return 0;
 }
+
+#ifndef E20_NO_MAIN
+/**
+    Main function
+    Takes command-line args as documented below
+*/
+int main(int argc, char *argv[]) {
+    /*
+        Parse the command-line arguments
+    */
+    char *filename = nullptr;
+    bool do_help = false;
+    bool arg_error = false;
+    string perf_file;
+    int mem_bits = 13;
+    for (int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if (arg.rfind("-",0)==0) {
+            if (arg== "-h" || arg == "--help")
+                do_help = true;
+            else if (arg=="--mem-bits") {
+                i++;
+                mem_bits = i<argc ? atoi(argv[i]) : 0;
+                if (mem_bits != 13 && mem_bits != 16 && mem_bits != 20 && mem_bits != 24)
+                    arg_error = true;
+            }
+            else if (arg=="--perf") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    perf_file = argv[i];
+            }
+            else
+                arg_error = true;
+        } else {
+            if (filename == nullptr)
+                filename = argv[i];
+            else
+                arg_error = true;
+        }
+    }
+    /* Display error message if appropriate */
+    if (arg_error || do_help || filename == nullptr) {
+        cerr << "usage " << argv[0] << " [-h] [--mem-bits BITS] [--perf FILE] filename" << endl << endl;
+        cerr << "Simulate E20 machine" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --mem-bits BITS  Address width of the simulated memory: 13 (the"<<endl;
+        cerr << "                 standard E20), 16, 20 or 24. 20 and 24 use 32-bit"<<endl;
+        cerr << "                 words"<<endl;
+        cerr << "  --perf FILE  Write host performance counters for each phase to"<<endl;
+        cerr << "                 FILE as JSON (- for stderr)"<<endl;
+        return 1;
+    }
+
+    ifstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file "<<filename<<endl;
+        return 1;
+    }
+    // Each configuration is its own instantiation of the simulator
+    switch (mem_bits) {
+    case 13:
+        return run_machine<E20>(f, perf_file);
+    case 16:
+        return run_machine<E20_64K>(f, perf_file);
+    case 20:
+        return run_machine<E20_1M>(f, perf_file);
+    default:
+        return run_machine<E20_16M>(f, perf_file);
+    }
+}
+#endif
@@ -17,14 +17,191 @@ sim.cpp
 #include <list>
 #include <regex>
 #include <cstdint>
+#include <memory>
+#include "e20machine.h"
+#include "perfcount.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <utility>
 
 using namespace std;
 
 // Some helpful constant values that we'll be using.
-size_t const static NUM_REGS = 8;
-size_t const static MEM_SIZE = 1<<13;
+// Memory size and register count come from the E20Machine configuration.
 size_t const static REG_SIZE = 1<<16;
 
+// Host performance counters, enabled with --perf
+PerfCounters perf;
+// Total number of E20 instructions executed by simulate
+uint64_t instructions_executed = 0;
+
+/*
+    Output formats for the cache log, selected with --log-format.
+
+    LOG_NONE discards the log. LOG_TEXT is the original column layout. LOG_CSV and LOG_JSONL emit
+    one record per line. LOG_BINARY emits packed 16-byte little-endian
+    records: level (1 byte; 1 = L1, 2 = L2, 3 = victim cache), status
+    (1 byte), 2 bytes padding, then pc, addr and row as 4-byte unsigned
+    integers.
+*/
+enum LogFormat { LOG_NONE, LOG_TEXT, LOG_CSV, LOG_JSONL, LOG_BINARY };
+enum LogStatus { LOG_HIT, LOG_MISS, LOG_SW };
+
+static const char* const CACHE_NAMES[] = {"", "L1", "L2", "VC"};
+static const char* const STATUS_NAMES[] = {"HIT", "MISS", "SW"};
+
+LogFormat log_format = LOG_TEXT;
+vector<char> log_buf;
+size_t log_len = 0;
+
+/*
+    Writes any buffered log records to stdout.
+*/
+void log_flush() {
+    if (log_len > 0) {
+        fwrite(log_buf.data(), 1, log_len, stdout);
+        log_len = 0;
+    }
+    fflush(stdout);
+}
+
+/*
+    Prepares the log buffer. Records are formatted by hand straight into
+    this buffer and only handed to stdout when it fills up, so logging
+    costs no temporary strings and no flush per access.
+
+    @param format The output format to use
+
+    @param capacity Size of the log buffer in bytes
+*/
+void log_open(LogFormat format, size_t capacity) {
+    log_format = format;
+    log_buf.assign(capacity < 256 ? 256 : capacity, 0);
+    log_len = 0;
+    if (log_format == LOG_CSV) {
+        const char header[] = "cache,status,pc,addr,row\n";
+        memcpy(log_buf.data(), header, sizeof(header) - 1);
+        log_len = sizeof(header) - 1;
+    }
+}
+
+/*
+    Appends the characters of str to the log buffer, padding with
+    spaces to width on the given side.
+*/
+inline void log_put(const char* str, size_t len, size_t width = 0, bool pad_left = false) {
+    size_t pad = width > len ? width - len : 0;
+    char* out = log_buf.data() + log_len;
+    if (pad_left) {
+        memset(out, ' ', pad);
+        out += pad;
+    }
+    memcpy(out, str, len);
+    out += len;
+    if (!pad_left) {
+        memset(out, ' ', pad);
+        out += pad;
+    }
+    log_len = out - log_buf.data();
+}
+
+inline void log_put_uint(unsigned value, size_t width = 0) {
+    char digits[10];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    log_put(digits + n, sizeof(digits) - n, width, true);
+}
+
+inline void log_put_le32(unsigned value) {
+    char* out = log_buf.data() + log_len;
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+    log_len += 4;
+}
+
+/*
+    Records a single cache access in the log.
+
+    @param level The cache level. 1 for L1, 2 for L2, 3 for the victim cache
+
+    @param status Whether the access was a hit, a miss or a store
+
+    @param pc The program counter of the instruction
+
+    @param addr The memory address accessed
+
+    @param row The cache row the address maps to
+*/
+void print_log_entry(int level, LogStatus status, int pc, int addr, int row) {
+    if (log_format == LOG_NONE)
+        return;
+    // no record is longer than this, so one check per entry suffices
+    if (log_buf.size() - log_len < 128)
+        log_flush();
+    const char* name = CACHE_NAMES[level];
+    const char* stat = STATUS_NAMES[status];
+    size_t name_len = strlen(name);
+    size_t stat_len = strlen(stat);
+    switch (log_format) {
+    case LOG_TEXT:
+        log_put(name, name_len);
+        log_put(" ", 1);
+        log_put(stat, stat_len, name_len < 7 ? 7 - name_len : 0);
+        log_put(" pc:", 4);
+        log_put_uint(pc, 5);
+        log_put("\taddr:", 6);
+        log_put_uint(addr, 5);
+        log_put("\trow:", 5);
+        log_put_uint(row, 4);
+        log_put("\n", 1);
+        break;
+    case LOG_CSV:
+        log_put(name, name_len);
+        log_put(",", 1);
+        log_put(stat, stat_len);
+        log_put(",", 1);
+        log_put_uint(pc);
+        log_put(",", 1);
+        log_put_uint(addr);
+        log_put(",", 1);
+        log_put_uint(row);
+        log_put("\n", 1);
+        break;
+    case LOG_JSONL:
+        log_put("{\"cache\":\"", 10);
+        log_put(name, name_len);
+        log_put("\",\"status\":\"", 12);
+        log_put(stat, stat_len);
+        log_put("\",\"pc\":", 7);
+        log_put_uint(pc);
+        log_put(",\"addr\":", 8);
+        log_put_uint(addr);
+        log_put(",\"row\":", 7);
+        log_put_uint(row);
+        log_put("}\n", 2);
+        break;
+    case LOG_BINARY: {
+        char* out = log_buf.data() + log_len;
+        out[0] = level;
+        out[1] = status;
+        out[2] = out[3] = 0;
+        log_len += 4;
+        log_put_le32(pc);
+        log_put_le32(addr);
+        log_put_le32(row);
+        break;
+    }
+    case LOG_NONE:
+        break;
+    }
+}
+
 /*
     Prints out the correctly-formatted configuration of a cache.
 
@@ -42,30 +219,26 @@ size_t const static REG_SIZE = 1<<16;
 */
 
 void print_cache_config(const string& cache_name, int size, int assoc, int blocksize, int num_rows) {
-    cout << "Cache " << cache_name << " has size " << size <<
+    // keep stdout a pure record stream for the structured log formats
+    ostream& out = (log_format == LOG_TEXT) ? cout : cerr;
+    out << "Cache " << cache_name << " has size " << size <<
         ", associativity " << assoc << ", blocksize " << blocksize <<
         ", rows " << num_rows << endl;
 } 
 
 
 
-void print_log_entry(const string& cache_name, const string& status, int pc, int addr, int row) {
-    cout << left << setw(8) << cache_name + " " + status << right <<
-        " pc:" << setw(5) << pc <<
-        "\taddr:" << setw(5) << addr <<
-        "\trow:" << setw(4) << row << endl;
-}
-
 /*
-    Loads an E20 machine code file into the list
-    provided by mem. We assume that mem is
-    large enough to hold the values in the machine
-    code file.
+    Loads an E20 machine code file into the memory
+    of the given machine. The program must fit in
+    the machine's memory.
 
     @param f Open file to read from
-    @param mem Array represetnting memory into which to read program
+    @param m Machine into whose memory to read program
+    @return The number of words loaded
 */
-void load_machine_code(ifstream &f, uint16_t mem[]) {
+template <typename Machine>
+size_t load_machine_code(ifstream &f, Machine &m) {
     regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
     size_t expectedaddr = 0;
     string line;
@@ -81,13 +254,14 @@ void load_machine_code(ifstream &f, uint16_t mem[]) {
             cerr << "Memory addresses encountered out of sequence: " << addr << endl;
             exit(1);
         }
-        if (addr >= MEM_SIZE) {
+        if (addr >= Machine::MEM_SIZE) {
             cerr << "Program too big for memory" << endl;
             exit(1);
         }
         expectedaddr ++;
-        mem[addr] = instr;
+        m.memory.store(addr, instr);
     }
+    return expectedaddr;
 }
 
 /*
@@ -101,6 +275,81 @@ void load_machine_code(ifstream &f, uint16_t mem[]) {
     @param memquantity How many words of memory to dump
 */
 
+/*
+    Geometry and contents of one cache level. Each entry of lines is a
+    cache row holding the tags it contains, most recently used first.
+*/
+struct Cache {
+    int size = 0;
+    int assoc = 0;
+    int blocksize = 0;
+    int rows = 0;
+    vector<list<unsigned>> lines;
+    // lw results at this level; stores are write-through and not counted
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+/*
+    How L2 relates to the L1 side (L1 plus victim cache).
+
+    L2_NINE: neither inclusive nor exclusive. L2 is filled on every
+        L1 miss and every store, and evictions on either side are
+        independent. This is the original behavior.
+    L2_INCLUSIVE: as NINE, but a block evicted from L2 is also
+        invalidated in L1 and the victim cache (back-invalidation).
+    L2_EXCLUSIVE: L2 only holds blocks evicted from the L1 side. A
+        block found in L2 moves up and leaves L2. L1 and L2 must have
+        the same blocksize, since blocks move between them whole.
+*/
+enum L2Policy { L2_NINE, L2_INCLUSIVE, L2_EXCLUSIVE };
+static const char* const L2_POLICY_NAMES[] = {"nine", "inclusive", "exclusive"};
+
+/*
+    Latencies, in cycles, for the timing estimate. Every instruction
+    takes one cycle, and each lw adds the latency of every level it
+    probes: L1 always, then the victim cache, L2 and memory on misses.
+*/
+struct Latencies {
+    int L1 = 1;
+    int victim = 1;
+    int L2 = 10;
+    int memory = 100;
+};
+
+/*
+    The whole cache hierarchy: L1, an optional small fully-associative
+    victim cache that catches blocks evicted from L1, and an optional
+    L2 with its inclusion policy.
+*/
+struct Hierarchy {
+    Cache L1;
+    Cache victim; // one row of L1 block numbers; unused if assoc is 0
+    Cache L2;
+    bool L2Enable = false;
+    L2Policy policy = L2_NINE;
+    Latencies latency;
+    uint64_t loads = 0;
+    // lw that missed in every level and had to go to memory
+    uint64_t memory_loads = 0;
+};
+
+/*
+    Cache options from the command line.
+*/
+struct CacheOptions {
+    string config;
+    int victim_entries = 0;
+    L2Policy policy = L2_NINE;
+    bool stats = false;
+    bool compare = false;
+    Latencies latency;
+    // --sample: 0 sample_period means every instruction is simulated in detail
+    size_t sample_period = 0;
+    size_t sample_warmup = 0;
+    size_t sample_window = 0;
+};
+
 bool hitStatus = false;
 auto hit_check(vector<list<unsigned>>& cache, int row, int tag) {
     hitStatus = false;
@@ -115,158 +364,278 @@ auto hit_check(vector<list<unsigned>>& cache, int row, int tag) {
     return hitStatus;
 }
 
-void add_or_evict(vector<list<unsigned>>& cache, int row, int assoc, int tag, string const& cacheLevel, bool writeEnable, uint16_t pc, 
-    uint16_t memoryAddress) { 
+long add_or_evict(vector<list<unsigned>>& cache, int row, int assoc, int tag, int cacheLevel, bool writeEnable, unsigned pc, 
+    unsigned memoryAddress) { 
+    long evictedTag = -1;
     if (hitStatus) 
     {
         if (writeEnable) 
         {
-        print_log_entry(cacheLevel, "SW", pc, memoryAddress, row);
+        print_log_entry(cacheLevel, LOG_SW, pc, memoryAddress, row);
         }
         else
-            print_log_entry(cacheLevel, "HIT", pc, memoryAddress, row);
+            print_log_entry(cacheLevel, LOG_HIT, pc, memoryAddress, row);
     } 
     else 
     {
         if (writeEnable) 
         {
-            print_log_entry(cacheLevel, "SW", pc, memoryAddress, row);
+            print_log_entry(cacheLevel, LOG_SW, pc, memoryAddress, row);
         }
         else
-            print_log_entry(cacheLevel, "MISS", pc, memoryAddress, row);
+            print_log_entry(cacheLevel, LOG_MISS, pc, memoryAddress, row);
         if (cache[row].size() >= assoc) 
         {
+            evictedTag = cache[row].back();
             cache[row].pop_back(); 
         }
     }
     cache[row].push_front(tag); 
+    return evictedTag;
 }
 
+/*
+    Looks up memoryAddress in one cache level, logs the result and
+    makes its block most recently used, allocating it on a miss.
 
-/**
-    Main function
-    Takes command-line args as documented below
+    @param evicted Set to the number of the block evicted to make
+        room, or -1 if none was
+    @return true on a hit
 */
-int main(int argc, char *argv[]) {
-    /*
-        Parse the command-line arguments
-    */
-    char *filename = nullptr;
-    bool do_help = false;
-    bool arg_error = false;
-    string cache_config;
-    for (int i=1; i<argc; i++) {
-        string arg(argv[i]);
-        if (arg.rfind("-",0)==0) {
-            if (arg== "-h" || arg == "--help")
-                do_help = true;
-            else if (arg=="--cache") {
-                i++;
-                if (i>=argc)
-                    arg_error = true;
-                else
-                    cache_config = argv[i];
-            }
-            else
-                arg_error = true;
-        } else {
-            if (filename == nullptr)
-                filename = argv[i];
-            else
-                arg_error = true;
+bool cache_access(Cache &cache, int cacheLevel, bool writeEnable, unsigned pc, unsigned memoryAddress,
+    long &evicted) {
+    int blockID = memoryAddress / cache.blocksize;
+    int row = blockID % cache.rows;
+    int tag = blockID / cache.rows;
+    hit_check(cache.lines, row, tag);
+    long evictedTag = add_or_evict(cache.lines, row, cache.assoc, tag, cacheLevel, writeEnable, pc, memoryAddress);
+    evicted = evictedTag < 0 ? -1 : evictedTag * cache.rows + row;
+    if (!writeEnable) {
+        if (hitStatus)
+            cache.hits++;
+        else
+            cache.misses++;
+    }
+    return hitStatus;
+}
+
+/*
+    Removes a block from a cache without logging.
+
+    @return true if the block was present
+*/
+bool cache_remove(Cache &cache, unsigned block) {
+    list<unsigned> &line = cache.lines[block % cache.rows];
+    unsigned tag = block / cache.rows;
+    for (auto iter = line.begin(); iter != line.end(); ++iter) {
+        if (*iter == tag) {
+            line.erase(iter);
+            return true;
         }
     }
-    /* Display error message if appropriate */
-    if (arg_error || do_help || filename == nullptr) {
-        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] filename" << endl << endl;
-        cerr << "Simulate E20 cache" << endl << endl;
-        cerr << "positional arguments:" << endl;
-        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
-        cerr << "optional arguments:"<<endl;
-        cerr << "  -h, --help  show this help message and exit"<<endl;
-        cerr << "  --cache CACHE  Cache configuration: size,assoc,blocksize (for one"<<endl;
-        cerr << "                 cache) or"<<endl;
-        cerr << "                 size,assoc,blocksize,size,assoc,blocksize"<<endl;
-        cerr << "                 (for two caches)"<<endl;
-        return 1;
+    return false;
+}
+
+/*
+    Inserts a block as most recently used without logging.
+
+    @return The number of the block evicted to make room, or -1
+*/
+long cache_insert(Cache &cache, unsigned block) {
+    cache_remove(cache, block);
+    int row = block % cache.rows;
+    list<unsigned> &line = cache.lines[row];
+    long evicted = -1;
+    if (line.size() >= (size_t)cache.assoc) {
+        evicted = long(line.back()) * cache.rows + row;
+        line.pop_back();
     }
+    line.push_front(block / cache.rows);
+    return evicted;
+}
 
-    ifstream f(filename);
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
-        return 1;
+/*
+    Invalidates every L1 and victim cache block that overlaps a block
+    evicted from an inclusive L2.
+*/
+void back_invalidate(Hierarchy &h, long L2Block) {
+    unsigned base = L2Block * h.L2.blocksize;
+    unsigned end = base + h.L2.blocksize;
+    for (unsigned addr = base - base % h.L1.blocksize; addr < end; addr += h.L1.blocksize) {
+        cache_remove(h.L1, addr / h.L1.blocksize);
+        if (h.victim.assoc > 0)
+            cache_remove(h.victim, addr / h.L1.blocksize);
     }
-    uint16_t memory[MEM_SIZE] = {0};
-    uint16_t regs[NUM_REGS] = {0};
-    uint16_t pc = 0;
-    load_machine_code(f, memory);
+}
 
-    int L1size, L1assoc, L1blocksize, L1rows, L2size, L2assoc, L2blocksize, L2rows;
-    bool L2Enable = false;
-    /* parse cache config */
-    if (cache_config.size() > 0) {
-        vector<int> parts;
-        size_t pos;
-        size_t lastpos = 0;
-        while ((pos = cache_config.find(",", lastpos)) != string::npos) {
-            parts.push_back(stoi(cache_config.substr(lastpos,pos)));
-            lastpos = pos + 1;
-        }
-        parts.push_back(stoi(cache_config.substr(lastpos)));
-        if (parts.size() == 3) {
-            L1size = parts[0];
-            L1assoc = parts[1];
-            L1blocksize = parts[2];
-            L1rows = L1size/L1assoc/L1blocksize;      
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, L1rows);
-        } else if (parts.size() == 6) {
-            L1size = parts[0];
-            L1assoc = parts[1];
-            L1blocksize = parts[2];
-            L2size = parts[3];
-            L2assoc = parts[4];
-            L2blocksize = parts[5];  
-            L1rows = L1size/L1assoc/L1blocksize; 
-            L2rows = L2size/L2assoc/L2blocksize;
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, L1rows);
-            print_cache_config("L2", L2size, L2assoc, L2blocksize, L2rows);
-            L2Enable = true;
+/*
+    Handles a block evicted from L1: it moves into the victim cache if
+    there is one.
+
+    @return The block that leaves the L1 side, or -1
+*/
+long L1_evicted(Hierarchy &h, long block) {
+    if (block >= 0 && h.victim.assoc > 0)
+        block = cache_insert(h.victim, block);
+    return block;
+}
+
+/*
+    Handles a block that left the L1 side: it is written into L2 if L2
+    is exclusive, and dropped otherwise. Called only after L2 has been
+    probed, so that it cannot displace the block being looked up.
+*/
+void L1_castout(Hierarchy &h, long block) {
+    if (block >= 0 && h.L2Enable && h.policy == L2_EXCLUSIVE)
+        cache_insert(h.L2, block);
+}
+
+/*
+    Runs one lw through the hierarchy: L1, then the victim cache, then
+    L2, stopping at the first hit. Each level probed is logged.
+*/
+void cache_load(Hierarchy &h, unsigned pc, unsigned memoryAddress) {
+    h.loads++;
+    long L1Evicted;
+    if (cache_access(h.L1, 1, false, pc, memoryAddress, L1Evicted))
+        return;
+    bool victimHit = false;
+    if (h.victim.assoc > 0) {
+        victimHit = cache_remove(h.victim, memoryAddress / h.L1.blocksize);
+        if (victimHit)
+            h.victim.hits++;
+        else
+            h.victim.misses++;
+        print_log_entry(3, victimHit ? LOG_HIT : LOG_MISS, pc, memoryAddress, 0);
+    }
+    long castout = L1_evicted(h, L1Evicted);
+    if (!victimHit && !h.L2Enable)
+        h.memory_loads++;
+    else if (!victimHit) {
+        bool L2Hit;
+        if (h.policy == L2_EXCLUSIVE) {
+            unsigned block = memoryAddress / h.L2.blocksize;
+            L2Hit = cache_remove(h.L2, block);
+            if (L2Hit)
+                h.L2.hits++;
+            else
+                h.L2.misses++;
+            print_log_entry(2, L2Hit ? LOG_HIT : LOG_MISS, pc, memoryAddress, block % h.L2.rows);
         } else {
-            cerr << "Invalid cache config"  << endl;
-            return 1;
+            long L2Evicted;
+            L2Hit = cache_access(h.L2, 2, false, pc, memoryAddress, L2Evicted);
+            if (L2Evicted >= 0 && h.policy == L2_INCLUSIVE)
+                back_invalidate(h, L2Evicted);
         }
+        if (!L2Hit)
+            h.memory_loads++;
     }
+    L1_castout(h, castout);
+}
 
-    vector<list<unsigned>> L1;
-    for (size_t i = 0; i < L1rows; i++) {
-        L1.push_back(list<unsigned>()); 
+/*
+    Runs one sw through the hierarchy. Stores write through to every
+    level and allocate in L1; they also allocate in a non-exclusive L2.
+*/
+void cache_store(Hierarchy &h, unsigned pc, unsigned memoryAddress) {
+    long L1Evicted;
+    if (!cache_access(h.L1, 1, true, pc, memoryAddress, L1Evicted) && h.victim.assoc > 0)
+        cache_remove(h.victim, memoryAddress / h.L1.blocksize);
+    long castout = L1_evicted(h, L1Evicted);
+    if (h.L2Enable && h.policy == L2_EXCLUSIVE) {
+        // the block now lives in L1, so it leaves L2
+        unsigned block = memoryAddress / h.L2.blocksize;
+        cache_remove(h.L2, block);
+        print_log_entry(2, LOG_SW, pc, memoryAddress, block % h.L2.rows);
+    } else if (h.L2Enable) {
+        long L2Evicted;
+        cache_access(h.L2, 2, true, pc, memoryAddress, L2Evicted);
+        if (L2Evicted >= 0 && h.policy == L2_INCLUSIVE)
+            back_invalidate(h, L2Evicted);
     }
-    vector<list<unsigned>> L2;
-    if(L2Enable)
-    {
-        for (size_t i = 0; i < L2rows; i++) {
-            L2.push_back(list<unsigned>());
-        }
+    L1_castout(h, castout);
+}
+
+/*
+    Estimates the cycles taken by a run from its cache statistics,
+    using the latencies of the hierarchy.
+*/
+uint64_t estimate_cycles(const Hierarchy &h, uint64_t instructions) {
+    return instructions + h.loads * h.latency.L1 +
+        (h.victim.hits + h.victim.misses) * h.latency.victim +
+        (h.L2.hits + h.L2.misses) * h.latency.L2 +
+        h.memory_loads * h.latency.memory;
+}
+
+/*
+    Prints the lw hit and miss counts of each level, the combined
+    miss rate (the fraction of lw that had to go to memory), and the
+    estimated cycle count.
+
+    @param h The hierarchy after the run
+    @param instructions Number of instructions simulated
+*/
+void print_cache_stats(const Hierarchy &h, uint64_t instructions) {
+    ostream& out = (log_format == LOG_TEXT) ? cout : cerr;
+    const Cache* levels[] = {&h.L1, &h.victim, &h.L2};
+    const bool enabled[] = {true, h.victim.assoc > 0, h.L2Enable};
+    const char* names[] = {"L1", "VC", "L2"};
+    out << fixed << setprecision(4);
+    for (int level = 0; level < 3; level++) {
+        if (!enabled[level])
+            continue;
+        uint64_t probes = levels[level]->hits + levels[level]->misses;
+        out << "Cache " << names[level] << " had " << probes << " loads, " << levels[level]->hits <<
+            " hits, " << levels[level]->misses << " misses, miss rate " <<
+            (probes > 0 ? double(levels[level]->misses) / probes : 0.0) << endl;
     }
+    out << "Combined " << h.loads << " loads, " << h.memory_loads << " to memory, miss rate " <<
+        (h.loads > 0 ? double(h.memory_loads) / h.loads : 0.0) << endl;
+    uint64_t cycles = estimate_cycles(h, instructions);
+    out << "Estimated " << cycles << " cycles for " << instructions << " instructions, CPI " <<
+        (instructions > 0 ? double(cycles) / instructions : 0.0) << endl;
+    out << defaultfloat;
+}
+
 
-    int L1BlockID, L2BlockID, L1Row, L2Row, L1Tag, L2Tag;
+/*
+    Runs the E20 program in memory through the cache model until it
+    halts or until max_steps instructions have been executed. Every
+    lw and sw is run through the cache hierarchy and logged. With
+    ModelCaches false this is the plain functional loop of sim.cpp,
+    used to fast-forward in sampling mode; the hierarchy is untouched.
 
+    @param m The machine to run, updated in place
+    @param h The cache hierarchy, updated in place
+    @param max_steps The most instructions to execute
+    @return true if the program halted
+*/
+template <typename Machine, bool ModelCaches = true>
+bool simulate(Machine &m, Hierarchy &h, size_t max_steps = SIZE_MAX) {
+    typedef typename Machine::word Word;
+    // pc is kept in a local so that stores to memory cannot alias it
+    Word pc = m.pc;
+    Word *regs = m.regs;
+    typename Machine::memory_type &memory = m.memory;
     bool running = true;
 
-    while (running) {
-        uint16_t instr = memory[pc & 8191];
+    size_t steps = 0;
+    while (running && steps < max_steps) {
+        steps++;
+        Word instr = memory.load(pc & Machine::ADDR_MASK);
         uint16_t opcode = (instr >> 13) & 7;
         uint16_t regA = (instr >> 10) & 7;
         uint16_t regB = (instr >> 7) & 7;
         uint16_t regC = (instr >> 4) & 7;
 
-        uint16_t imm = instr & 127;
-        uint16_t imm13 = instr & 8191;
+        Word imm = instr & 127;
+        Word imm13 = instr & 8191;
         uint16_t final_four = instr & 15;  
 
         // sign extend imm 
-        imm = (imm & 64) ? (imm | 65408) : imm; 
-        imm13 = (imm13 & 4096) ? (imm13 | 57344) : imm13;
+        imm = (imm & 64) ? (imm | Word(~127)) : imm; 
+        // imm13 is an absolute address for j and jal, so it is not sign
+        // extended; this matters once memory is larger than 8K words
         //remove pc here
         //pc++;
 
@@ -279,7 +648,7 @@ int main(int argc, char *argv[]) {
 
         // Handle each opcode with if-else conditions.
         if (opcode == 2) {  // j (jump)
-            if (pc%8192 == imm13)
+            if (pc % Machine::MEM_SIZE == imm13)
                 running = false;
             pc = imm13;
         } 
@@ -340,42 +709,27 @@ int main(int argc, char *argv[]) {
         }
         
         if (opcode == 4){ // (load word)
-            uint16_t memory_address = (regs[regA] + imm) % 8192;
-            regs[regB] = memory[memory_address];
-
-            L1BlockID = memory_address / L1blocksize;
-            L1Row = L1BlockID % L1rows;
-            L1Tag = L1BlockID / L1rows;
-
-            hit_check(L1, L1Row, L1Tag);
-            add_or_evict(L1, L1Row, L1assoc, L1Tag, "L1", false, pc, memory_address);
-            if((hitStatus == false && L2Enable)) {
-                L2BlockID = memory_address / L2blocksize;
-                L2Row = L2BlockID % L2rows;
-                L2Tag = L2BlockID / L2rows;
-                hit_check(L2, L2Row, L2Tag);
-                add_or_evict(L2, L2Row, L2assoc, L2Tag, "L2", false, pc, memory_address);
-            } 
+            Word memory_address = Word(regs[regA] + imm) & Machine::ADDR_MASK;
+            regs[regB] = memory.load(memory_address);
+
+            if (ModelCaches) {
+                perf_begin(perf, PERF_CACHE);
+                cache_load(h, pc, memory_address);
+                perf_end(perf, PERF_CACHE);
+            }
             pc++;
 
         }
         if (opcode == 5){ // (store word)
             //added %8192
-            uint16_t memory_address = (regs[regA] + imm) % 8192;
-            memory[memory_address] = regs[regB];
+            Word memory_address = Word(regs[regA] + imm) & Machine::ADDR_MASK;
+            memory.store(memory_address, regs[regB]);
             //uncommented pc++
-            L1BlockID = memory_address / L1blocksize;
-            L1Row = L1BlockID % L1rows;
-            L1Tag = L1BlockID / L1rows;
-            hit_check(L1, L1Row, L1Tag);
-            add_or_evict(L1, L1Row, L1assoc, L1Tag, "L1", true, pc, memory_address);
-            if((L2Enable)) {
-                L2BlockID = memory_address / L2blocksize;
-                L2Row = L2BlockID % L2rows;
-                L2Tag = L2BlockID / L2rows;
-                hit_check(L2, L2Row, L2Tag);
-                add_or_evict(L2, L2Row, L2assoc, L2Tag, "L2", true, pc, memory_address);
-            } 
+            if (ModelCaches) {
+                perf_begin(perf, PERF_CACHE);
+                cache_store(h, pc, memory_address);
+                perf_end(perf, PERF_CACHE);
+            }
             pc++;
         }
 
@@ -398,6 +752,460 @@ int main(int argc, char *argv[]) {
     //added code to set reg[0] to 0, to make it immutable
     regs[0] = 0;
     }
+    m.pc = pc;
+    instructions_executed += steps;
+    return !running;
+}
+
+/*
+    Estimates a ratio sum(num)/sum(den) from per-window samples, with
+    the half-width of its 95% confidence interval (normal
+    approximation of the ratio estimator). The half-width is infinite
+    with fewer than two windows.
+*/
+pair<double, double> ratio_estimate(const vector<double> &num, const vector<double> &den) {
+    size_t n = num.size();
+    double num_sum = 0, den_sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        num_sum += num[i];
+        den_sum += den[i];
+    }
+    if (den_sum == 0)
+        return make_pair(0.0, numeric_limits<double>::infinity());
+    double ratio = num_sum / den_sum;
+    if (n < 2)
+        return make_pair(ratio, numeric_limits<double>::infinity());
+    double sq_sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        double residual = num[i] - ratio * den[i];
+        sq_sum += residual * residual;
+    }
+    double den_mean = den_sum / n;
+    double std_error = sqrt(sq_sum / (n - 1) / n) / den_mean;
+    return make_pair(ratio, 1.96 * std_error);
+}
+
+/*
+    Runs the program with systematic sampling (as in SMARTS). Each
+    sampling period starts with a functional fast-forward that skips
+    the cache model, then warms the caches up in detail without
+    measuring or logging, then measures one window in detail. Only the
+    measured windows are logged. Prints the sampled miss rates and
+    CPI, with 95% confidence intervals, and the estimated cycles for
+    the whole run. If the program halts before the first window, it
+    is run again from the start in full detail and the statistics of
+    that run are printed instead.
+
+    @param m The machine to run, updated in place
+    @param h The cache hierarchy, updated in place
+    @param options Supplies the sampling period, warm-up and window,
+        all in instructions
+*/
+template <typename Machine>
+void simulate_sampled(Machine &m, Hierarchy &h, const CacheOptions &options) {
+    size_t fast_forward = options.sample_period - options.sample_warmup - options.sample_window;
+    vector<double> loads, L1_misses, memory_loads, cycles, instructions;
+    LogFormat saved_format = log_format;
+    Machine initial(m);
+    Hierarchy initial_h(h);
+    uint64_t initial_instructions = instructions_executed;
+    bool halted = false;
+    while (!halted) {
+        halted = simulate<Machine, false>(m, h, fast_forward);
+        if (halted)
+            break;
+        log_format = LOG_NONE;
+        halted = simulate(m, h, options.sample_warmup);
+        log_format = saved_format;
+        if (halted)
+            break;
+        uint64_t loads_before = h.loads;
+        uint64_t L1_misses_before = h.L1.misses;
+        uint64_t memory_loads_before = h.memory_loads;
+        uint64_t stalls_before = estimate_cycles(h, 0);
+        uint64_t instructions_before = instructions_executed;
+        halted = simulate(m, h, options.sample_window);
+        uint64_t window_instructions = instructions_executed - instructions_before;
+        loads.push_back(h.loads - loads_before);
+        L1_misses.push_back(h.L1.misses - L1_misses_before);
+        memory_loads.push_back(h.memory_loads - memory_loads_before);
+        cycles.push_back(estimate_cycles(h, 0) - stalls_before + window_instructions);
+        instructions.push_back(window_instructions);
+    }
+
+    ostream& out = (log_format == LOG_TEXT) ? cout : cerr;
+    if (loads.empty()) {
+        out << "Halted after " << instructions_executed - initial_instructions <<
+            " instructions, before the first sampled window; simulating in full detail" << endl;
+        m = initial;
+        h = initial_h;
+        instructions_executed = initial_instructions;
+        simulate(m, h);
+        log_flush();
+        print_cache_stats(h, instructions_executed);
+        return;
+    }
+    log_flush();
+
+    pair<double, double> L1_rate = ratio_estimate(L1_misses, loads);
+    pair<double, double> combined_rate = ratio_estimate(memory_loads, loads);
+    pair<double, double> cpi = ratio_estimate(cycles, instructions);
+    out << fixed << setprecision(4);
+    out << "Sampled " << loads.size() << " windows of " << options.sample_window <<
+        " instructions every " << options.sample_period << " (warm-up " << options.sample_warmup << ")" << endl;
+    out << "Sampled L1 miss rate " << L1_rate.first << " +/- " << L1_rate.second << endl;
+    out << "Sampled combined miss rate " << combined_rate.first << " +/- " << combined_rate.second << endl;
+    out << "Sampled CPI " << cpi.first << " +/- " << cpi.second << endl;
+    out << setprecision(0) << "Estimated " << cpi.first * instructions_executed << " +/- " <<
+        cpi.second * instructions_executed << " cycles for " << instructions_executed << " instructions" << endl;
+    out << defaultfloat << setprecision(6);
+}
+
+/*
+    Gives the hierarchy a fully-associative victim cache holding the
+    given number of L1 blocks, or removes it if entries is 0.
+*/
+void configure_victim(Hierarchy &h, int entries) {
+    h.victim = Cache();
+    if (entries <= 0)
+        return;
+    h.victim.assoc = entries;
+    h.victim.blocksize = h.L1.blocksize;
+    h.victim.size = entries * h.L1.blocksize;
+    h.victim.rows = 1;
+    h.victim.lines.resize(1);
+}
+
+/*
+    Runs the program once for each L2 policy, with and without a
+    victim cache. For each it prints how many lw got past L1 and the
+    victim cache, and the combined miss rate compared with the
+    original hierarchy (NINE, no victim cache).
+
+    @param initial The machine with the program loaded, not yet run
+    @param base The hierarchy to vary; its caches must be empty
+    @param entries Size of the victim cache to try
+*/
+template <typename Machine>
+void compare_hierarchies(const Machine &initial, const Hierarchy &base, int entries) {
+    LogFormat saved_format = log_format;
+    log_format = LOG_NONE;
+    ostream& out = (saved_format == LOG_TEXT) ? cout : cerr;
+    double baseline = 0;
+    int num_policies = base.L2Enable ? 3 : 1;
+    out << fixed << setprecision(4);
+    for (int policy = 0; policy < num_policies; policy++) {
+        if (policy == L2_EXCLUSIVE && base.L2.blocksize != base.L1.blocksize) {
+            out << "Policy exclusive skipped: L1 and L2 blocksizes differ" << endl;
+            continue;
+        }
+        for (int victim = 0; victim <= entries; victim += entries) {
+            Hierarchy h = base;
+            h.policy = L2Policy(policy);
+            configure_victim(h, victim);
+            unique_ptr<Machine> m(new Machine(initial));
+            simulate(*m, h);
+            double rate = h.loads > 0 ? double(h.memory_loads) / h.loads : 0.0;
+            if (policy == L2_NINE && victim == 0)
+                baseline = rate;
+            out << "Policy " << L2_POLICY_NAMES[policy] << ", victim " << victim << ": " << h.loads <<
+                " loads, " << h.L1.misses - h.victim.hits << " past L1, " << h.memory_loads <<
+                " to memory, miss rate " << rate <<
+                ", change " << showpos << rate - baseline << noshowpos << endl;
+        }
+    }
+    out << defaultfloat;
+    log_format = saved_format;
+}
+
+/*
+    Loads a program and runs it through the cache model
+    on a machine of the given configuration.
+
+    @param f Open file containing the machine code
+    @param options The cache options from the command line
+    @param perf_file Where to write performance counters, if not empty
+    @return The exit status for main
+*/
+template <typename Machine>
+int run_machine(ifstream &f, const CacheOptions &options, const string &perf_file) {
+    // Heap-allocated, since the flat memory of the larger
+    // configurations does not belong on the stack
+    unique_ptr<Machine> m(new Machine());
+    if (!perf_file.empty())
+        perf_open(perf);
+    perf_begin(perf, PERF_LOAD);
+    load_machine_code(f, *m);
+    perf_end(perf, PERF_LOAD);
+
+    Hierarchy h;
+    Cache &L1 = h.L1;
+    Cache &L2 = h.L2;
+    bool &L2Enable = h.L2Enable;
+    const string &cache_config = options.config;
+    /* parse cache config */
+    if (cache_config.size() > 0) {
+        vector<int> parts;
+        size_t pos;
+        size_t lastpos = 0;
+        while ((pos = cache_config.find(",", lastpos)) != string::npos) {
+            parts.push_back(stoi(cache_config.substr(lastpos,pos)));
+            lastpos = pos + 1;
+        }
+        parts.push_back(stoi(cache_config.substr(lastpos)));
+        if (parts.size() == 3) {
+            L1.size = parts[0];
+            L1.assoc = parts[1];
+            L1.blocksize = parts[2];
+            L1.rows = L1.size/L1.assoc/L1.blocksize;      
+            print_cache_config("L1", L1.size, L1.assoc, L1.blocksize, L1.rows);
+        } else if (parts.size() == 6) {
+            L1.size = parts[0];
+            L1.assoc = parts[1];
+            L1.blocksize = parts[2];
+            L2.size = parts[3];
+            L2.assoc = parts[4];
+            L2.blocksize = parts[5];  
+            L1.rows = L1.size/L1.assoc/L1.blocksize; 
+            L2.rows = L2.size/L2.assoc/L2.blocksize;
+            print_cache_config("L1", L1.size, L1.assoc, L1.blocksize, L1.rows);
+            print_cache_config("L2", L2.size, L2.assoc, L2.blocksize, L2.rows);
+            L2Enable = true;
+        } else {
+            cerr << "Invalid cache config"  << endl;
+            return 1;
+        }
+    }
+
+    L1.lines.resize(L1.rows);
+    if(L2Enable)
+    {
+        L2.lines.resize(L2.rows);
+        h.policy = options.policy;
+        if (h.policy == L2_EXCLUSIVE && L2.blocksize != L1.blocksize) {
+            cerr << "An exclusive L2 needs the same blocksize as L1" << endl;
+            return 1;
+        }
+    }
+    h.latency = options.latency;
+    if (options.victim_entries > 0) {
+        configure_victim(h, options.victim_entries);
+        print_cache_config("VC", h.victim.size, h.victim.assoc, h.victim.blocksize, h.victim.rows);
+    }
+    if (h.policy != L2_NINE)
+        ((log_format == LOG_TEXT) ? cout : cerr) << "Cache L2 is " << L2_POLICY_NAMES[h.policy] << endl;
 
+    perf_begin(perf, PERF_EXECUTE);
+    if (options.compare)
+        compare_hierarchies(*m, h, options.victim_entries > 0 ? options.victim_entries : 4);
+    else if (options.sample_period > 0)
+        simulate_sampled(*m, h, options);
+    else
+        simulate(*m, h);
+    perf_end(perf, PERF_EXECUTE);
+
+    log_flush();
+    if (options.stats && options.sample_period == 0 && !options.compare)
+        print_cache_stats(h, instructions_executed);
+    if (perf_file == "-")
+        perf_report(perf, cerr, "simcache", instructions_executed);
+    else if (!perf_file.empty()) {
+        ofstream perf_out(perf_file);
+        perf_report(perf, perf_out, "simcache", instructions_executed);
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+#ifndef E20_NO_MAIN
+/**
+    Main function
+    Takes command-line args as documented below
+*/
+int main(int argc, char *argv[]) {
+    /*
+        Parse the command-line arguments
+    */
+    char *filename = nullptr;
+    bool do_help = false;
+    bool arg_error = false;
+    string perf_file;
+    CacheOptions cache_options;
+    int mem_bits = 13;
+    LogFormat format = LOG_TEXT;
+    size_t log_buffer_size = 1<<20;
+    for (int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if (arg.rfind("-",0)==0) {
+            if (arg== "-h" || arg == "--help")
+                do_help = true;
+            else if (arg=="--mem-bits") {
+                i++;
+                mem_bits = i<argc ? atoi(argv[i]) : 0;
+                if (mem_bits != 13 && mem_bits != 16 && mem_bits != 20 && mem_bits != 24)
+                    arg_error = true;
+            }
+            else if (arg=="--perf") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    perf_file = argv[i];
+            }
+            else if (arg=="--perf-cache")
+                perf.cache_phase = true;
+            else if (arg=="--cache") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    cache_options.config = argv[i];
+            }
+            else if (arg=="--victim") {
+                i++;
+                cache_options.victim_entries = i<argc ? atoi(argv[i]) : 0;
+                if (cache_options.victim_entries <= 0)
+                    arg_error = true;
+            }
+            else if (arg=="--l2-policy") {
+                i++;
+                string name = i<argc ? argv[i] : "";
+                if (name == "nine")
+                    cache_options.policy = L2_NINE;
+                else if (name == "inclusive")
+                    cache_options.policy = L2_INCLUSIVE;
+                else if (name == "exclusive")
+                    cache_options.policy = L2_EXCLUSIVE;
+                else
+                    arg_error = true;
+            }
+            else if (arg=="--sample") {
+                i++;
+                unsigned long period, warmup, window;
+                if (i>=argc || sscanf(argv[i], "%lu,%lu,%lu", &period, &warmup, &window) != 3 ||
+                        window == 0 || warmup + window > period)
+                    arg_error = true;
+                else {
+                    cache_options.sample_period = period;
+                    cache_options.sample_warmup = warmup;
+                    cache_options.sample_window = window;
+                }
+            }
+            else if (arg=="--latency") {
+                i++;
+                Latencies &latency = cache_options.latency;
+                int values[4];
+                int count = i<argc ? sscanf(argv[i], "%d,%d,%d,%d", &values[0], &values[1], &values[2], &values[3]) : 0;
+                if (count == 4) {
+                    latency.L1 = values[0];
+                    latency.victim = values[1];
+                    latency.L2 = values[2];
+                    latency.memory = values[3];
+                } else if (count == 3) {
+                    latency.L1 = values[0];
+                    latency.L2 = values[1];
+                    latency.memory = values[2];
+                } else
+                    arg_error = true;
+            }
+            else if (arg=="--stats")
+                cache_options.stats = true;
+            else if (arg=="--compare")
+                cache_options.compare = true;
+            else if (arg=="--log-format") {
+                i++;
+                string name = i<argc ? argv[i] : "";
+                if (name == "none")
+                    format = LOG_NONE;
+                else if (name == "text")
+                    format = LOG_TEXT;
+                else if (name == "csv")
+                    format = LOG_CSV;
+                else if (name == "jsonl")
+                    format = LOG_JSONL;
+                else if (name == "binary")
+                    format = LOG_BINARY;
+                else
+                    arg_error = true;
+            }
+            else if (arg=="--log-buffer") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    log_buffer_size = strtoul(argv[i], nullptr, 10);
+            }
+            else
+                arg_error = true;
+        } else {
+            if (filename == nullptr)
+                filename = argv[i];
+            else
+                arg_error = true;
+        }
+    }
+    if (perf.cache_phase && perf_file.empty())
+        arg_error = true;
+    /* Display error message if appropriate */
+    if (arg_error || do_help || filename == nullptr) {
+        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] [--victim N] [--l2-policy POLICY] [--stats] [--compare] [--sample PERIOD,WARMUP,WINDOW] [--latency L1,[VC,]L2,MEM] [--log-format FORMAT] [--log-buffer BYTES] [--mem-bits BITS] [--perf FILE] [--perf-cache] filename" << endl << endl;
+        cerr << "Simulate E20 cache" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --cache CACHE  Cache configuration: size,assoc,blocksize (for one"<<endl;
+        cerr << "                 cache) or"<<endl;
+        cerr << "                 size,assoc,blocksize,size,assoc,blocksize"<<endl;
+        cerr << "                 (for two caches)"<<endl;
+        cerr << "  --victim N  Add a fully-associative victim cache of N L1 blocks"<<endl;
+        cerr << "                 between L1 and L2"<<endl;
+        cerr << "  --l2-policy POLICY  How L2 relates to L1: nine (default),"<<endl;
+        cerr << "                 inclusive (with back-invalidation) or exclusive"<<endl;
+        cerr << "                 (L1 and L2 blocksizes must then be equal)"<<endl;
+        cerr << "  --stats     Print hit and miss counts for each cache, the"<<endl;
+        cerr << "                 combined miss rate and estimated cycles after the log"<<endl;
+        cerr << "  --compare   Instead of the log, print the combined miss rate"<<endl;
+        cerr << "                 for every L2 policy with and without a victim cache"<<endl;
+        cerr << "                 (of N blocks if --victim is given, otherwise 4)"<<endl;
+        cerr << "  --sample PERIOD,WARMUP,WINDOW  Sampling mode: in every PERIOD"<<endl;
+        cerr << "                 instructions, fast-forward without the caches, warm"<<endl;
+        cerr << "                 them up for WARMUP instructions, then measure and"<<endl;
+        cerr << "                 log WINDOW instructions. Prints miss rates and CPI"<<endl;
+        cerr << "                 with 95% confidence intervals"<<endl;
+        cerr << "  --latency L1,[VC,]L2,MEM  Cycles for an L1, victim cache, L2 and"<<endl;
+        cerr << "                 memory access in the timing estimate (default"<<endl;
+        cerr << "                 1,1,10,100; VC stays 1 if only three are given)"<<endl;
+        cerr << "  --log-format FORMAT  Cache log format: text (default), csv, jsonl,"<<endl;
+        cerr << "                 binary or none. Non-text formats print the cache"<<endl;
+        cerr << "                 configuration to stderr"<<endl;
+        cerr << "  --log-buffer BYTES  Size of the log output buffer (default 1048576)"<<endl;
+        cerr << "  --mem-bits BITS  Address width of the simulated memory: 13 (the"<<endl;
+        cerr << "                 standard E20), 16, 20 or 24. 20 and 24 use 32-bit"<<endl;
+        cerr << "                 words"<<endl;
+        cerr << "  --perf FILE  Write host performance counters for each phase to"<<endl;
+        cerr << "                 FILE as JSON (- for stderr)"<<endl;
+        cerr << "  --perf-cache  With --perf, also measure the cache model on its own."<<endl;
+        cerr << "                 This reads the counters around every lw/sw, which"<<endl;
+        cerr << "                 inflates the execute phase"<<endl;
+        return 1;
+    }
+
+    ifstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file "<<filename<<endl;
+        return 1;
+    }
+    log_open(format, log_buffer_size);
+    // Each configuration is its own instantiation of the simulator
+    switch (mem_bits) {
+    case 13:
+        return run_machine<E20>(f, cache_options, perf_file);
+    case 16:
+        return run_machine<E20_64K>(f, cache_options, perf_file);
+    case 20:
+        return run_machine<E20_1M>(f, cache_options, perf_file);
+    default:
+        return run_machine<E20_16M>(f, cache_options, perf_file);
+    }
+}
+#endif
@@ -0,0 +1,126 @@
+/*
+CS-UY 2214
+Static analysis of E20 programs
+simcfg.cpp
+
+Loads a .bin file the same way sim does and, without running it,
+prints its control-flow graph, loop nests, unreachable code and
+statically known lw/sw addresses (see e20cfg.h), as Graphviz DOT or
+JSON.
+
+    g++ -O2 -o simcfg simcfg.cpp
+    ./simcfg --format dot program.bin | dot -Tsvg > program.svg
+*/
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <regex>
+#include <cstdlib>
+#include <cstdint>
+#include <memory>
+#include "e20machine.h"
+#include "perfcount.h"
+#include "e20cfg.h"
+
+// reuse the loader of the simulator
+#define E20_NO_MAIN
+#include "sim.cpp"
+#undef E20_NO_MAIN
+
+/*
+    Loads the program in f into a machine of the given configuration
+    and writes its analysis to cout.
+
+    @param f Open file to read from
+    @param json If true, write JSON; otherwise DOT
+    @return Exit status of the program
+*/
+template <typename Machine>
+int analyze_machine(ifstream &f, bool json) {
+    unique_ptr<Machine> m(new Machine());
+    size_t image_size = load_machine_code(f, *m);
+    Cfg cfg = build_cfg(*m, image_size);
+    if (json)
+        write_cfg_json(cfg, cout);
+    else
+        write_cfg_dot(cfg, cout);
+    return 0;
+}
+
+/**
+    Main function
+    Takes command-line args as documented below
+*/
+int main(int argc, char *argv[]) {
+    /*
+        Parse the command-line arguments
+    */
+    char *filename = nullptr;
+    bool do_help = false;
+    bool arg_error = false;
+    bool json = true;
+    int mem_bits = 13;
+    for (int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if (arg.rfind("-",0)==0) {
+            if (arg== "-h" || arg == "--help")
+                do_help = true;
+            else if (arg=="--format") {
+                i++;
+                string format = i<argc ? argv[i] : "";
+                if (format == "json")
+                    json = true;
+                else if (format == "dot")
+                    json = false;
+                else
+                    arg_error = true;
+            }
+            else if (arg=="--mem-bits") {
+                i++;
+                mem_bits = i<argc ? atoi(argv[i]) : 0;
+                if (mem_bits != 13 && mem_bits != 16 && mem_bits != 20 && mem_bits != 24)
+                    arg_error = true;
+            }
+            else
+                arg_error = true;
+        } else {
+            if (filename == nullptr)
+                filename = argv[i];
+            else
+                arg_error = true;
+        }
+    }
+    /* Display error message if appropriate */
+    if (arg_error || do_help || filename == nullptr) {
+        cerr << "usage " << argv[0] << " [-h] [--format json|dot] [--mem-bits BITS] filename" << endl << endl;
+        cerr << "Print the control-flow graph and loops of an E20 program" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --format json|dot  Output format (default json)"<<endl;
+        cerr << "  --mem-bits BITS  Address width of the machine: 13 (the standard"<<endl;
+        cerr << "                 E20), 16, 20 or 24"<<endl;
+        return 1;
+    }
+
+    ifstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file "<<filename<<endl;
+        return 1;
+    }
+    switch (mem_bits) {
+    case 13:
+        return analyze_machine<E20>(f, json);
+    case 16:
+        return analyze_machine<E20_64K>(f, json);
+    case 20:
+        return analyze_machine<E20_1M>(f, json);
+    default:
+        return analyze_machine<E20_16M>(f, json);
+    }
+}
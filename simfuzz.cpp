@@ -0,0 +1,363 @@
+/*
+CS-UY 2214
+Differential fuzzer for the E20 simulators
+simfuzz.cpp
+
+Builds sim.cpp and simcache.cpp into this program side by side,
+runs randomly generated E20 programs on each of them with an
+instruction budget, both on the standard E20 and on E20_1M (32-bit
+words, paged memory), and reports any difference in the final
+pc, registers or memory. Failing programs are shrunk to a
+minimal reproducer and printed in the usual .bin format.
+
+Standalone driver:
+    g++ -O2 -o simfuzz simfuzz.cpp
+    ./simfuzz [--seed N] [--runs N] [--steps N] [--length N]
+
+libFuzzer:
+    clang++ -O2 -g -fsanitize=fuzzer -DE20_LIBFUZZER -o simfuzz simfuzz.cpp
+    ./simfuzz
+*/
+
+// Every header used by the simulators must be included here, before
+// they are pulled into their namespaces below.
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <random>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "e20machine.h"
+#include "perfcount.h"
+
+#define E20_NO_MAIN
+namespace sim_engine {
+#include "sim.cpp"
+}
+namespace simcache_engine {
+#include "simcache.cpp"
+}
+#undef E20_NO_MAIN
+
+using namespace std;
+
+// Programs are generated for the standard E20 and also run on this
+// larger configuration, which has 32-bit words and paged memory
+typedef E20_1M LargeMachine;
+size_t const static MAX_PROGRAM = E20::MEM_SIZE;
+
+template <typename Machine>
+bool run_sim(Machine &m, size_t max_steps) {
+    return sim_engine::simulate(m, max_steps);
+}
+
+/*
+    Runs the cache simulator with small caches, so that evictions
+    happen often, under one L2 policy and victim cache size. The cache
+    model must never change the architectural result. An exclusive L2
+    needs the L1 blocksize; the other policies use a larger one.
+*/
+template <typename Machine, simcache_engine::L2Policy Policy, int VictimEntries>
+bool run_simcache(Machine &m, size_t max_steps) {
+    simcache_engine::Hierarchy h;
+    h.L1.size = 8;
+    h.L1.assoc = 2;
+    h.L1.blocksize = 2;
+    h.L1.rows = 2;
+    h.L1.lines.resize(h.L1.rows);
+    h.L2.size = 32;
+    h.L2.assoc = 4;
+    h.L2.blocksize = Policy == simcache_engine::L2_EXCLUSIVE ? 2 : 4;
+    h.L2.rows = h.L2.size / h.L2.assoc / h.L2.blocksize;
+    h.L2.lines.resize(h.L2.rows);
+    h.L2Enable = true;
+    h.policy = Policy;
+    simcache_engine::configure_victim(h, VictimEntries);
+    return simcache_engine::simulate(m, h, max_steps);
+}
+
+template <typename Machine>
+bool run_simcache_functional(Machine &m, size_t max_steps) {
+    // the fast-forward loop of sampling mode
+    simcache_engine::Hierarchy h;
+    return simcache_engine::simulate<Machine, false>(m, h, max_steps);
+}
+
+/*
+    Every engine under test on one machine configuration. The first
+    entry is the reference that the others are compared against. Each
+    cache configuration is its own engine, so that a run depends only
+    on the program.
+*/
+template <typename Machine>
+struct Engine {
+    const char* name;
+    bool (*run)(Machine &m, size_t max_steps);
+};
+
+template <typename Machine>
+const vector<Engine<Machine>> &engines() {
+    using simcache_engine::L2_NINE;
+    using simcache_engine::L2_INCLUSIVE;
+    using simcache_engine::L2_EXCLUSIVE;
+    static const vector<Engine<Machine>> list = {
+        {"sim", run_sim<Machine>},
+        {"simcache (L1 8,2,2, L2 32,4,4 nine)", run_simcache<Machine, L2_NINE, 0>},
+        {"simcache (L1 8,2,2, L2 32,4,4 inclusive)", run_simcache<Machine, L2_INCLUSIVE, 0>},
+        {"simcache (L1 8,2,2, L2 32,4,2 exclusive)", run_simcache<Machine, L2_EXCLUSIVE, 0>},
+        {"simcache (L1 8,2,2, victim 2, L2 32,4,4 nine)", run_simcache<Machine, L2_NINE, 2>},
+        {"simcache (L1 8,2,2, victim 2, L2 32,4,4 inclusive)", run_simcache<Machine, L2_INCLUSIVE, 2>},
+        {"simcache (L1 8,2,2, victim 2, L2 32,4,2 exclusive)", run_simcache<Machine, L2_EXCLUSIVE, 2>},
+        {"simcache-functional", run_simcache_functional<Machine>},
+    };
+    return list;
+}
+
+/*
+    Forces an arbitrary 16-bit word into a valid E20 instruction.
+    Only opcode 0 has invalid encodings; those are mapped onto one
+    of the six defined three-register functions.
+*/
+uint16_t make_valid(uint16_t instr) {
+    static const uint16_t FUNCS[] = {0, 1, 2, 3, 4, 8};
+    if ((instr >> 13) != 0)
+        return instr;
+    return (instr & ~15) | FUNCS[(instr & 15) % 6];
+}
+
+/*
+    Runs program on every engine for one machine configuration and
+    compares the final states.
+
+    @param config Name of the configuration, for the report
+    @param program The machine code, loaded at address 0
+    @param max_steps Instruction budget for each engine
+    @param report If true, print the differing state to cerr
+    @return true if every engine agrees with the reference
+*/
+template <typename Machine>
+bool engines_agree(const char* config, const vector<uint16_t> &program, size_t max_steps, bool report) {
+    const vector<Engine<Machine>> &list = engines<Machine>();
+    static vector<unique_ptr<Machine>> results(list.size());
+    vector<bool> halted(list.size());
+    for (size_t e = 0; e < list.size(); e++) {
+        results[e].reset(new Machine());
+        Machine &m = *results[e];
+        for (size_t addr = 0; addr < program.size() && addr < Machine::MEM_SIZE; addr++)
+            m.memory.store(addr, program[addr]);
+        halted[e] = list[e].run(m, max_steps);
+    }
+    bool agree = true;
+    const Machine &ref = *results[0];
+    const char* ref_name = list[0].name;
+    for (size_t e = 1; e < list.size(); e++) {
+        const Machine &m = *results[e];
+        const char* name = list[e].name;
+        if (halted[e] != halted[0]) {
+            agree = false;
+            if (report)
+                cerr << config << " " << name << ": halted=" << halted[e] << ", " << ref_name << ": halted=" << halted[0] << endl;
+        }
+        if (m.pc != ref.pc) {
+            agree = false;
+            if (report)
+                cerr << config << " " << name << ": pc=" << m.pc << ", " << ref_name << ": pc=" << ref.pc << endl;
+        }
+        for (size_t reg = 0; reg < Machine::NUM_REGS; reg++)
+            if (m.regs[reg] != ref.regs[reg]) {
+                agree = false;
+                if (report)
+                    cerr << config << " " << name << ": $" << reg << "=" << m.regs[reg] << ", " << ref_name << ": $" << reg << "=" << ref.regs[reg] << endl;
+            }
+        // the word-by-word scan is only needed for the report
+        if (m.memory == ref.memory)
+            continue;
+        agree = false;
+        for (size_t addr = 0; report && addr < Machine::MEM_SIZE; addr++)
+            if (m.memory.load(addr) != ref.memory.load(addr))
+                cerr << config << " " << name << ": mem[" << addr << "]=" << m.memory.load(addr) << ", " << ref_name << ": mem[" << addr << "]=" << ref.memory.load(addr) << endl;
+    }
+    return agree;
+}
+
+/*
+    Runs program on every engine, on the standard E20 and on the
+    larger configuration.
+
+    @return true if the engines agree on both
+*/
+bool machines_agree(const vector<uint16_t> &program, size_t max_steps, bool report) {
+    bool agree = engines_agree<E20>("E20", program, max_steps, report);
+    return engines_agree<LargeMachine>("E20_1M", program, max_steps, report) && agree;
+}
+
+/*
+    Shrinks a failing program while it keeps failing: first by
+    deleting runs of instructions (halving the run length each
+    round), then by replacing single instructions with a nop and
+    clearing their operand bits one at a time, until neither step
+    makes progress.
+
+    @param program A program on which the engines disagree
+    @param max_steps Instruction budget for each engine
+    @return A smaller program on which the engines still disagree
+*/
+vector<uint16_t> shrink(vector<uint16_t> program, size_t max_steps) {
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (size_t chunk = program.size() / 2; chunk > 0; chunk /= 2) {
+            for (size_t start = 0; start + chunk <= program.size();) {
+                vector<uint16_t> candidate(program);
+                candidate.erase(candidate.begin() + start, candidate.begin() + start + chunk);
+                if (!candidate.empty() && !machines_agree(candidate, max_steps, false)) {
+                    program = candidate;
+                    progress = true;
+                }
+                else
+                    start += chunk;
+            }
+        }
+        for (size_t addr = 0; addr < program.size(); addr++) {
+            vector<uint16_t> candidate(program);
+            candidate[addr] = 0; // add $0,$0,$0
+            if (candidate[addr] != program[addr] && !machines_agree(candidate, max_steps, false)) {
+                program = candidate;
+                progress = true;
+                continue;
+            }
+            for (int bit = 12; bit >= 0; bit--) {
+                candidate = program;
+                candidate[addr] = make_valid(program[addr] & ~(1 << bit));
+                if (candidate[addr] != program[addr] && !machines_agree(candidate, max_steps, false)) {
+                    program = candidate;
+                    progress = true;
+                }
+            }
+        }
+    }
+    return program;
+}
+
+/*
+    Prints a program in the format read by load_machine_code.
+*/
+void print_program(const vector<uint16_t> &program) {
+    for (size_t addr = 0; addr < program.size(); addr++) {
+        cout << "ram[" << addr << "] = 16'b";
+        for (int bit = 15; bit >= 0; bit--)
+            cout << ((program[addr] >> bit) & 1);
+        cout << ";" << endl;
+    }
+}
+
+/*
+    Generates a random valid E20 program. Programs usually end in a
+    halt, and immediates are biased towards small values so that
+    branches and loads stay near the code.
+*/
+vector<uint16_t> random_program(mt19937 &rng, size_t max_length) {
+    size_t length = 1 + rng() % max_length;
+    vector<uint16_t> program(length);
+    for (size_t addr = 0; addr < length; addr++) {
+        uint16_t instr = make_valid(rng());
+        uint16_t opcode = instr >> 13;
+        if (opcode == 2 || opcode == 3) {
+            if (rng() % 4 != 0)
+                instr = (opcode << 13) | (rng() % length);
+        } else if (opcode != 0 && rng() % 2 == 0) {
+            instr = (instr & ~127) | ((rng() % 32 - 16) & 127);
+        }
+        program[addr] = instr;
+    }
+    if (rng() % 8 != 0)
+        program.push_back((2 << 13) | length); // halt: j to itself
+    return program;
+}
+
+size_t const static FUZZ_STEPS = 10000;
+
+#ifdef E20_LIBFUZZER
+extern "C" int LLVMFuzzerInitialize(int *, char ***) {
+    simcache_engine::log_open(simcache_engine::LOG_NONE, 0);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    vector<uint16_t> program;
+    for (size_t i = 0; i + 1 < size && program.size() < MAX_PROGRAM; i += 2)
+        program.push_back(make_valid(data[i] | (data[i+1] << 8)));
+    if (program.empty())
+        return 0;
+    if (!machines_agree(program, FUZZ_STEPS, false)) {
+        program = shrink(program, FUZZ_STEPS);
+        machines_agree(program, FUZZ_STEPS, true);
+        print_program(program);
+        abort();
+    }
+    return 0;
+}
+#else
+/**
+    Main function
+    Takes command-line args as documented below
+*/
+int main(int argc, char *argv[]) {
+    unsigned long seed = random_device()();
+    size_t runs = 100000;
+    size_t max_steps = FUZZ_STEPS;
+    size_t max_length = 64;
+    bool arg_error = false;
+    for (int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if (i+1 < argc && arg == "--seed")
+            seed = strtoul(argv[++i], nullptr, 10);
+        else if (i+1 < argc && arg == "--runs")
+            runs = strtoul(argv[++i], nullptr, 10);
+        else if (i+1 < argc && arg == "--steps")
+            max_steps = strtoul(argv[++i], nullptr, 10);
+        else if (i+1 < argc && arg == "--length")
+            max_length = strtoul(argv[++i], nullptr, 10);
+        else
+            arg_error = true;
+    }
+    if (arg_error || max_length == 0 || max_length >= MAX_PROGRAM) {
+        cerr << "usage " << argv[0] << " [-h] [--seed N] [--runs N] [--steps N] [--length N]" << endl << endl;
+        cerr << "Differentially fuzz the E20 simulators" << endl << endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --seed N    Random seed (default: random)"<<endl;
+        cerr << "  --runs N    Number of programs to try (default 100000)"<<endl;
+        cerr << "  --steps N   Instruction budget per program (default 10000)"<<endl;
+        cerr << "  --length N  Maximum program length in words (default 64)"<<endl;
+        return 1;
+    }
+
+    simcache_engine::log_open(simcache_engine::LOG_NONE, 0);
+    mt19937 rng(seed);
+    cerr << "seed " << seed << endl;
+    for (size_t run = 0; run < runs; run++) {
+        vector<uint16_t> program = random_program(rng, max_length);
+        if (!machines_agree(program, max_steps, false)) {
+            cerr << "Engines disagree on run " << run << ", shrinking" << endl;
+            program = shrink(program, max_steps);
+            machines_agree(program, max_steps, true);
+            print_program(program);
+            return 1;
+        }
+    }
+    cerr << runs << " programs, no differences" << endl;
+    return 0;
+}
+#endif